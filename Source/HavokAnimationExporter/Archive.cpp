@@ -0,0 +1,221 @@
+#include "Pch.h"
+#include "Archive.h"
+#include "Hash.h"
+
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#include <compressapi.h>
+
+#pragma comment(lib, "Cabinet.lib")
+
+namespace
+{
+    const char ARCHIVE_MAGIC[4] = { 'H', 'A', 'E', 'A' };
+    const unsigned int ARCHIVE_VERSION = 1;
+
+    uint64_t align(uint64_t offset)
+    {
+        return (offset + 0xF) & ~0xFull;
+    }
+
+    // Returns an empty buffer if the data does not get any smaller.
+    std::vector<unsigned char> compressData(const void* data, size_t dataSize)
+    {
+        std::vector<unsigned char> compressedData;
+
+        COMPRESSOR_HANDLE compressor;
+        if (!CreateCompressor(COMPRESS_ALGORITHM_XPRESS_HUFF, nullptr, &compressor))
+            return compressedData;
+
+        SIZE_T compressedSize = 0;
+        Compress(compressor, data, dataSize, nullptr, 0, &compressedSize);
+
+        compressedData.resize(compressedSize);
+
+        if (compressedSize == 0 || compressedSize >= dataSize ||
+            !Compress(compressor, data, dataSize, compressedData.data(), compressedData.size(), &compressedSize) || compressedSize >= dataSize)
+            compressedData.clear();
+        else
+            compressedData.resize(compressedSize);
+
+        CloseCompressor(compressor);
+        return compressedData;
+    }
+}
+
+ArchiveWriter::~ArchiveWriter()
+{
+    discard();
+}
+
+bool ArchiveWriter::open(const char* filePath, bool compress)
+{
+    discard();
+
+    char tempFileSuffix[32];
+    sprintf(tempFileSuffix, ".%lx.tmp", GetCurrentProcessId());
+
+    this->filePath = filePath;
+    this->tempFilePath = this->filePath + tempFileSuffix;
+    this->compress = compress;
+
+    file = fopen(tempFilePath.c_str(), "wb");
+    if (file == nullptr)
+        return false;
+
+    // The header is rewritten with the index location when closing.
+    ArchiveHeader header = {};
+    fwrite(&header, sizeof(header), 1, file);
+
+    fileSize = sizeof(header);
+    failed = false;
+    entries.clear();
+    entryIndices.clear();
+
+    return true;
+}
+
+bool ArchiveWriter::add(const std::string& name, const void* data, size_t dataSize)
+{
+    Entry entry;
+    entry.name = name;
+    entry.entry = {};
+    entry.entry.size = dataSize;
+    entry.entry.storedSize = dataSize;
+    entry.entry.hash = computeHash(data, dataSize);
+
+    std::vector<unsigned char> compressedData;
+
+    if (compress && dataSize > 0)
+    {
+        compressedData = compressData(data, dataSize);
+
+        if (!compressedData.empty())
+        {
+            data = compressedData.data();
+            entry.entry.storedSize = compressedData.size();
+            entry.entry.compression = ARCHIVE_COMPRESSION_XPRESS_HUFF;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (file == nullptr)
+        return false;
+
+    if (entryIndices.find(name) != entryIndices.end())
+    {
+        failed = true;
+        return false;
+    }
+
+    static const char zeroes[16] = {};
+    fwrite(zeroes, 1, (size_t)(align(fileSize) - fileSize), file);
+
+    entry.entry.offset = align(fileSize);
+    fwrite(data, 1, (size_t)entry.entry.storedSize, file);
+
+    fileSize = entry.entry.offset + entry.entry.storedSize;
+
+    entryIndices.emplace(name, entries.size());
+    entries.push_back(entry);
+
+    if (ferror(file) != 0)
+    {
+        failed = true;
+        return false;
+    }
+
+    return true;
+}
+
+bool ArchiveWriter::close()
+{
+    if (file == nullptr)
+        return false;
+
+    if (failed)
+    {
+        discard();
+        return false;
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& lhs, const Entry& rhs)
+    {
+        return lhs.name < rhs.name;
+    });
+
+    static const char zeroes[16] = {};
+    fwrite(zeroes, 1, (size_t)(align(fileSize) - fileSize), file);
+
+    ArchiveHeader header = {};
+    memcpy(header.magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC));
+    header.version = ARCHIVE_VERSION;
+    header.indexOffset = align(fileSize);
+    header.entryCount = (unsigned int)entries.size();
+
+    unsigned int nameOffset = 0;
+
+    for (auto& entry : entries)
+    {
+        entry.entry.nameOffset = nameOffset;
+        entry.entry.nameSize = (unsigned int)entry.name.size();
+        nameOffset += entry.entry.nameSize;
+
+        fwrite(&entry.entry, sizeof(ArchiveEntry), 1, file);
+    }
+
+    for (auto& entry : entries)
+        fwrite(entry.name.data(), 1, entry.name.size(), file);
+
+    fseek(file, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, file);
+
+    const bool result = ferror(file) == 0;
+    fclose(file);
+    file = nullptr;
+
+    if (!result || !MoveFileExA(tempFilePath.c_str(), filePath.c_str(), MOVEFILE_REPLACE_EXISTING))
+    {
+        DeleteFileA(tempFilePath.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+void ArchiveWriter::discard()
+{
+    if (file == nullptr)
+        return;
+
+    fclose(file);
+    file = nullptr;
+
+    DeleteFileA(tempFilePath.c_str());
+}
+
+bool ArchiveWriter::checkIsOpen() const
+{
+    return file != nullptr;
+}
+
+bool ArchiveWriter::checkHasEntry(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return entryIndices.find(name) != entryIndices.end();
+}
+
+std::string ArchiveWriter::getEntryName(const std::string& filePath) const
+{
+    const size_t directorySize = this->filePath.find_last_of("\\/") + 1;
+
+    std::string name = filePath;
+
+    if (directorySize > 0 && name.compare(0, directorySize, this->filePath, 0, directorySize) == 0)
+        name = name.substr(directorySize);
+
+    std::replace(name.begin(), name.end(), '\\', '/');
+    return name;
+}
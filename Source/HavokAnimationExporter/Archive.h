@@ -0,0 +1,77 @@
+#pragma once
+
+// Single file holding many serialized assets, meant to be memory mapped by readers:
+//   ArchiveHeader
+//   entry data, every entry aligned to 16 bytes so packfiles can be loaded in place
+//   ArchiveEntry entries[entryCount], sorted by name for binary search
+//   char names[], referenced by the entries, not null terminated
+struct ArchiveHeader
+{
+    char magic[4];
+    unsigned int version;
+    uint64_t indexOffset;
+    unsigned int entryCount;
+    unsigned int reserved[3];
+};
+
+enum ArchiveCompression
+{
+    ARCHIVE_COMPRESSION_NONE,
+
+    // Windows Compression API XPRESS with Huffman coding.
+    ARCHIVE_COMPRESSION_XPRESS_HUFF
+};
+
+struct ArchiveEntry
+{
+    uint64_t offset;
+    uint64_t size;
+    uint64_t storedSize;
+    uint64_t hash;
+    unsigned int nameOffset;
+    unsigned int nameSize;
+    unsigned int compression;
+    unsigned int reserved;
+};
+
+// Appends entries to a temporary file, and writes the index and moves the archive into place when closed.
+// Entries can be added from several threads at once. An archive that gets destroyed without being closed,
+// or had an entry fail to be added, is discarded, leaving any previous archive at the path untouched.
+class ArchiveWriter
+{
+public:
+    ArchiveWriter() = default;
+    ArchiveWriter(const ArchiveWriter&) = delete;
+    ArchiveWriter& operator=(const ArchiveWriter&) = delete;
+    ~ArchiveWriter();
+
+    bool open(const char* filePath, bool compress);
+
+    // Fails if an entry with the same name was already added.
+    bool add(const std::string& name, const void* data, size_t dataSize);
+    bool close();
+    void discard();
+
+    bool checkIsOpen() const;
+    bool checkHasEntry(const std::string& name);
+
+    // Entries are named by their path relative to the archive's directory, with forward slashes.
+    std::string getEntryName(const std::string& filePath) const;
+
+private:
+    struct Entry
+    {
+        std::string name;
+        ArchiveEntry entry;
+    };
+
+    std::mutex mutex;
+    FILE* file = nullptr;
+    std::string filePath;
+    std::string tempFilePath;
+    uint64_t fileSize = 0;
+    bool compress = false;
+    bool failed = false;
+    std::vector<Entry> entries;
+    std::unordered_map<std::string, size_t> entryIndices;
+};
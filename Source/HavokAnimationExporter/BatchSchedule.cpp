@@ -0,0 +1,141 @@
+#include "Pch.h"
+#include "BatchSchedule.h"
+#include "Parallel.h"
+#include "MappedFile.h"
+
+#include <sys/stat.h>
+
+namespace
+{
+    // Reads the longest take duration from the file header, without importing the scene.
+    double getTakeDuration(const char* filePath)
+    {
+        FbxManager* lManager = FbxManager::Create();
+        FbxImporter* lImporter = FbxImporter::Create(lManager, "");
+
+        double duration = 0.0;
+
+        if (lImporter->Initialize(filePath))
+        {
+            for (int i = 0; i < lImporter->GetAnimStackCount(); i++)
+            {
+                FbxTakeInfo* lTakeInfo = lImporter->GetTakeInfo(i);
+
+                if (lTakeInfo != nullptr)
+                    duration = std::max<double>(duration, lTakeInfo->mLocalTimeSpan.GetDuration().GetSecondDouble());
+            }
+        }
+
+        lImporter->Destroy();
+        lManager->Destroy();
+
+        return duration;
+    }
+}
+
+uint64_t getFileSize(const char* filePath)
+{
+    struct _stat64 fileStat;
+    return _stat64(filePath, &fileStat) == 0 ? (uint64_t)fileStat.st_size : 0;
+}
+
+bool loadBatchHistory(const char* filePath, BatchHistory& history)
+{
+    FILE* file = fopen(filePath, "r");
+    if (file == nullptr)
+        return false;
+
+    char line[1024];
+    while (fgets(line, sizeof(line), file) != nullptr)
+    {
+        ClipTiming timing;
+        unsigned long long fileSize;
+        int pathOffset;
+
+        if (sscanf(line, "%lf %lf %llu %n", &timing.seconds, &timing.units, &fileSize, &pathOffset) != 3)
+            continue;
+
+        std::string path(line + pathOffset);
+        path.erase(path.find_last_not_of("\r\n") + 1);
+
+        timing.fileSize = fileSize;
+        history[path] = timing;
+    }
+
+    fclose(file);
+    return true;
+}
+
+bool saveBatchHistory(const char* filePath, const BatchHistory& history)
+{
+    std::string text;
+
+    for (auto& entry : history)
+    {
+        char line[128];
+        sprintf(line, "%.6f %.1f %llu ", entry.second.seconds, entry.second.units, (unsigned long long)entry.second.fileSize);
+
+        text += line + entry.first + "\n";
+    }
+
+    return writeFileAtomic(filePath, text.data(), text.size(), false);
+}
+
+std::vector<size_t> scheduleClips(const std::vector<std::string>& clipFilePaths, int boneCount, double fps,
+    const BatchHistory& history, std::vector<double>& units)
+{
+    const size_t clipCount = clipFilePaths.size();
+
+    std::vector<double> costs(clipCount);
+    std::vector<char> recorded(clipCount);
+
+    units.resize(clipCount);
+
+    // Reading take info parses the file header, so unrecorded clips get estimated in parallel, each with its own FBX manager.
+    parallelFor(clipCount, [&](size_t i)
+    {
+        const uint64_t fileSize = getFileSize(clipFilePaths[i].c_str());
+
+        auto timing = history.find(clipFilePaths[i]);
+        if (timing != history.end() && timing->second.fileSize == fileSize)
+        {
+            units[i] = timing->second.units;
+            costs[i] = timing->second.seconds;
+            recorded[i] = true;
+        }
+        else
+        {
+            const double frameCount = getTakeDuration(clipFilePaths[i].c_str()) * fps + 1.0;
+            units[i] = frameCount * boneCount + (double)fileSize / 1024.0;
+        }
+    });
+
+    double totalSeconds = 0.0;
+    double totalUnits = 0.0;
+
+    for (auto& entry : history)
+    {
+        totalSeconds += entry.second.seconds;
+        totalUnits += entry.second.units;
+    }
+
+    const double secondsPerUnit = totalSeconds > 0.0 && totalUnits > 0.0 ? totalSeconds / totalUnits : 1.0;
+
+    for (size_t i = 0; i < clipCount; i++)
+    {
+        if (!recorded[i])
+            costs[i] = units[i] * secondsPerUnit;
+    }
+
+    std::vector<size_t> order(clipCount);
+
+    for (size_t i = 0; i < clipCount; i++)
+        order[i] = i;
+
+    std::stable_sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs)
+    {
+        return costs[lhs] > costs[rhs];
+    });
+
+    return order;
+}
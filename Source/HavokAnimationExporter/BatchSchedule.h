@@ -0,0 +1,24 @@
+#pragma once
+
+// Time a clip took to export in an earlier run, with the cost estimate it had then.
+struct ClipTiming
+{
+    double seconds;
+    double units;
+    uint64_t fileSize;
+};
+
+uint64_t getFileSize(const char* filePath);
+
+typedef std::unordered_map<std::string, ClipTiming> BatchHistory;
+
+// One "seconds units fileSize path" line per clip.
+bool loadBatchHistory(const char* filePath, BatchHistory& history);
+bool saveBatchHistory(const char* filePath, const BatchHistory& history);
+
+// Returns clip indices ordered by estimated cost, longest first, so long clips don't start last and hold up the batch.
+// Clips with a recorded timing for the same file size use it. Others are estimated from their frame count, read from the
+// FBX take info, times the bone count, plus their file size, converted to seconds at the rate observed in the history.
+// units receives each clip's estimate, to be recorded along with its timing.
+std::vector<size_t> scheduleClips(const std::vector<std::string>& clipFilePaths, int boneCount, double fps,
+    const BatchHistory& history, std::vector<double>& units);
@@ -0,0 +1,53 @@
+#pragma once
+
+// Queue between pipeline stages. Producers block while it is full, which caps the memory held by work in flight.
+template<typename T>
+class BoundedQueue
+{
+    std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+    std::list<T> items;
+    size_t capacity;
+    size_t producerCount;
+
+public:
+    BoundedQueue(size_t capacity, size_t producerCount)
+        : capacity(std::max<size_t>(1, capacity)), producerCount(producerCount)
+    {
+    }
+
+    void push(T&& item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this]() { return items.size() < capacity; });
+
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+    }
+
+    // Waits for an item. Returns false once every producer is done and the queue is empty.
+    bool pop(T& item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this]() { return !items.empty() || producerCount == 0; });
+
+        if (items.empty())
+            return false;
+
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+
+        return true;
+    }
+
+    // Called by every producer when it has nothing left to push.
+    void finishProducer()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (--producerCount == 0)
+            notEmpty.notify_all();
+    }
+};
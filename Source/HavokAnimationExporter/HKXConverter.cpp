@@ -1,33 +1,11 @@
 #include "Pch.h"
+#include "Parallel.h"
+#include "HavokPackfile.h"
 
 // Code from HKXConverter
 
 namespace
 {
-    class Endian 
-    {
-    public:
-        static void swap(unsigned long long& x) 
-        {
-            x = _byteswap_uint64(x);
-        }
-
-        static void swap(unsigned int& x)
-        {
-            x = _byteswap_ulong(x);
-        }
-
-        static void swap(int& x) 
-        {
-            swap(reinterpret_cast<unsigned int&>(x));
-        }
-
-        static void swap(unsigned short& x)
-        {
-            x = _byteswap_ushort(x);
-        }
-    };
-
     class File
     {
     public:
@@ -216,46 +194,6 @@ namespace
         unsigned targetAddress;
     };
 
-    struct HavokPackfileHeader
-    {
-        int magic[2];
-        int userTag;
-        int fileVersion;
-        unsigned char layoutRules[4];
-        int numSections;
-        int contentsSectionIndex;
-        int contentsSectionOffset;
-        int contentsClassNameSectionIndex;
-        int contentsClassNameSectionOffset;
-        char contentsVersion[16];
-        int flags;
-        int pad[1];
-    };
-
-    struct HavokPackfileSectionHeader
-    {
-        char sectionTag[19];
-        char nullByte;
-        unsigned int absoluteDataStart;
-        unsigned int localFixupsOffset;
-        unsigned int globalFixupsOffset;
-        unsigned int virtualFixupsOffset;
-        unsigned int exportsOffset;
-        unsigned int importsOffset;
-        unsigned int endOffset;
-
-        void endianSwap()
-        {
-            Endian::swap(absoluteDataStart);
-            Endian::swap(localFixupsOffset);
-            Endian::swap(globalFixupsOffset);
-            Endian::swap(virtualFixupsOffset);
-            Endian::swap(exportsOffset);
-            Endian::swap(importsOffset);
-            Endian::swap(endOffset);
-        }
-    };
-
     struct HKXConverterImpl
     {
         std::vector<unsigned char> out;
@@ -366,46 +304,61 @@ namespace
                 fp->seek(1, SEEK_CUR);
         }
 
-        void convertStructure(File* fp, std::string typeName)
+        // Lookups used while converting data, built once the type and pointer tables are read.
+        std::unordered_map<std::string, std::vector<const HavokType*>> typesByName;
+        std::unordered_map<unsigned int, unsigned int> dataPointerTargets;
+
+        // Array data already converted, so data referenced from several objects is swapped exactly once.
+        std::mutex visitedArraysMutex;
+        std::unordered_set<unsigned int> visitedArrays;
+
+        bool visitArray(unsigned int address)
         {
-            unsigned int start = fp->tell();
-            bool found = false;
+            std::lock_guard<std::mutex> lock(visitedArraysMutex);
+            return visitedArrays.insert(address).second;
+        }
+
+        void buildTypeIndex()
+        {
+            typesByName.clear();
 
             for (std::list<HavokType>::iterator it = types.begin(); it != types.end(); it++)
-            {
-                if ((*it).name != typeName)
-                    continue;
-                unsigned int arrayOffset = start + (*it).objectSize;
-                found = true;
+                typesByName[(*it).name].push_back(&(*it));
+        }
 
-                if ((*it).parent)
-                    convertStructure(fp, (*it).parent->name);
+        void convertStructure(File* fp, const std::string& typeName)
+        {
+            unsigned int start = fp->tell();
+
+            std::unordered_map<std::string, std::vector<const HavokType*>>::const_iterator found = typesByName.find(typeName);
+            if (found == typesByName.end())
+                return;
+
+            for (const HavokType* type : found->second)
+            {
+                if (type->parent)
+                    convertStructure(fp, type->parent->name);
 
-                for (int i = 0; i < (*it).members.size(); i++)
+                for (int i = 0; i < type->members.size(); i++)
                 {
-                    int mainType = (*it).members[i].tag[0];
-                    int subType = (*it).members[i].tag[1];
+                    int mainType = type->members[i].tag[0];
+                    int subType = type->members[i].tag[1];
 
-                    fp->seek(start + (*it).members[i].offset, SEEK_SET);
+                    fp->seek(start + type->members[i].offset, SEEK_SET);
 
                     if (mainType == TYPE_ENUM)
                         mainType = subType;
 
                     if (mainType == TYPE_STRUCT)
-                        convertStructure(fp, (*it).members[i].structure);
+                        convertStructure(fp, type->members[i].structure);
 
                     else if (mainType == TYPE_POINTER)
                     {
                         endianSwap(fp->tell(), 4);
 
-                        for (std::list<HavokPointer>::iterator it2 = dataPointers.begin(); it2 != dataPointers.end(); it2++)
-                        {
-                            if (fp->tell() == (*it2).absAddress)
-                            {
-                                fp->seek((*it2).targetAddress, SEEK_SET);
-                                break;
-                            }
-                        }
+                        std::unordered_map<unsigned int, unsigned int>::const_iterator target = dataPointerTargets.find(fp->tell());
+                        if (target != dataPointerTargets.end())
+                            fp->seek(target->second, SEEK_SET);
                     }
                     else if ((mainType == TYPE_ARRAY) || (mainType == TYPE_SIMPLE_ARRAY))
                     {
@@ -426,33 +379,26 @@ namespace
                             continue;
                         }
 
-                        for (std::list<HavokPointer>::iterator it2 = dataPointers.begin(); it2 != dataPointers.end(); it2++)
-                        {
-                            if ((fp->tell() - 8) == (*it2).absAddress)
-                            {
-                                fp->seek((*it2).targetAddress, SEEK_SET);
-                                break;
-                            }
-                        }
+                        std::unordered_map<unsigned int, unsigned int>::const_iterator target = dataPointerTargets.find(fp->tell() - 8);
+                        if (target != dataPointerTargets.end())
+                            fp->seek(target->second, SEEK_SET);
 
                         unsigned int newAddr = fp->tell();
                         unsigned int size = 1;
 
-                        for (std::list<HavokType>::iterator it2 = types.begin(); it2 != types.end(); it2++)
-                        {
-                            if ((*it2).name == (*it).members[i].structure)
-                            {
-                                size = (*it2).objectSize;
-                                break;
-                            }
-                        }
+                        if (!visitArray(newAddr))
+                            continue;
+
+                        std::unordered_map<std::string, std::vector<const HavokType*>>::const_iterator structure = typesByName.find(type->members[i].structure);
+                        if (structure != typesByName.end())
+                            size = structure->second.front()->objectSize;
 
                         for (int j = 0; j < count; j++)
                         {
                             if (subType == TYPE_STRUCT)
                             {
                                 fp->seek(newAddr + j * size, SEEK_SET);
-                                convertStructure(fp, (*it).members[i].structure);
+                                convertStructure(fp, type->members[i].structure);
                             }
                             else
                             {
@@ -468,7 +414,7 @@ namespace
                     }
                     else
                     {
-                        unsigned int count = (*it).members[i].arraySize;
+                        unsigned int count = type->members[i].arraySize;
                         if (count == 0)
                             count = 1;
 
@@ -921,6 +867,7 @@ namespace
                     pointer.targetAddress = address2 + header.absoluteDataStart;
 
                     dataPointers.push_back(pointer);
+                    dataPointerTargets.emplace(pointer.absAddress, pointer.targetAddress);
 
                     if (fp->tell() >= header.absoluteDataStart + header.globalFixupsOffset)
                         break;
@@ -962,6 +909,10 @@ namespace
                     i++;
                 }
 
+                // Collect the objects first. They occupy disjoint byte ranges, so they are converted in parallel,
+                // each with its own read cursor.
+                std::vector<std::pair<unsigned int, std::string>> objects;
+
                 i = 0;
                 while (true)
                 {
@@ -997,15 +948,23 @@ namespace
                             break;
                     }
 
-                    fp->seek(header.absoluteDataStart + address, SEEK_SET);
-
-                    convertStructure(fp, typeName);
+                    objects.push_back(std::make_pair(header.absoluteDataStart + address, typeName));
 
                     if (back >= header.absoluteDataStart + header.exportsOffset)
                         break;
 
                     i++;
                 }
+
+                buildTypeIndex();
+
+                parallelFor(objects.size(), [&](size_t index)
+                {
+                    File file(fp->data, fp->dataSize);
+                    file.seek(objects[index].first, SEEK_SET);
+
+                    convertStructure(&file, objects[index].second);
+                });
             }
         }
     };
@@ -0,0 +1,53 @@
+#include "Pch.h"
+#include "Hash.h"
+#include "MappedFile.h"
+
+// MurmurHash3 finalizer. Without it, a word's top bit only reaches the top bit of the product,
+// so flipping the top bit of two words cancels out.
+static uint64_t mixHash(uint64_t hash)
+{
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDull;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ull;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+uint64_t computeHash(const void* data, size_t dataSize, uint64_t hash)
+{
+    const uint64_t prime = 0x100000001B3ull;
+    const unsigned char* bytes = (const unsigned char*)data;
+
+    size_t i = 0;
+
+    for (; i + 8 <= dataSize; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+
+        hash ^= mixHash(word);
+        hash *= prime;
+    }
+
+    for (; i < dataSize; i++)
+    {
+        hash ^= bytes[i];
+        hash *= prime;
+    }
+
+    hash ^= dataSize;
+
+    return mixHash(hash);
+}
+
+bool computeFileHash(const char* filePath, uint64_t& hash)
+{
+    MappedFile file;
+    if (!file.open(filePath))
+        return false;
+
+    hash = computeHash(file.data, file.dataSize);
+    return true;
+}
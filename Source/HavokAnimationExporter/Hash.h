@@ -0,0 +1,7 @@
+#pragma once
+
+// 64-bit FNV-1a over 8 byte words, each mixed with the MurmurHash3 finalizer, plus a final avalanche. Not cryptographic,
+// meant for cache keys and content fingerprints.
+uint64_t computeHash(const void* data, size_t dataSize, uint64_t hash = 0xCBF29CE484222325ull);
+
+bool computeFileHash(const char* filePath, uint64_t& hash);
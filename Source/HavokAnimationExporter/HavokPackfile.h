@@ -0,0 +1,81 @@
+#pragma once
+
+// Binary packfile structures, shared by the endian converter and the probe.
+
+class Endian 
+{
+public:
+    static void swap(unsigned long long& x) 
+    {
+        x = _byteswap_uint64(x);
+    }
+
+    static void swap(unsigned int& x)
+    {
+        x = _byteswap_ulong(x);
+    }
+
+    static void swap(int& x) 
+    {
+        swap(reinterpret_cast<unsigned int&>(x));
+    }
+
+    static void swap(unsigned short& x)
+    {
+        x = _byteswap_ushort(x);
+    }
+
+    static void swap(short& x)
+    {
+        swap(reinterpret_cast<unsigned short&>(x));
+    }
+};
+
+const unsigned int HAVOK_PACKFILE_MAGIC[2] = { 0x57E0E057, 0x10C0C010 };
+
+// Havok 2012 packfiles use file version 11. Older versions share the layout below.
+const int HAVOK_PACKFILE_VERSION_2012 = 11;
+const size_t HAVOK_PACKFILE_SECTION_HEADER_SIZE_2012 = 64;
+
+struct HavokPackfileHeader
+{
+    int magic[2];
+    int userTag;
+    int fileVersion;
+    unsigned char layoutRules[4];
+    int numSections;
+    int contentsSectionIndex;
+    int contentsSectionOffset;
+    int contentsClassNameSectionIndex;
+    int contentsClassNameSectionOffset;
+    char contentsVersion[16];
+    int flags;
+
+    // Padding before file version 11.
+    short maxPredicate;
+    short predicateArraySizePlusPadding;
+};
+
+struct HavokPackfileSectionHeader
+{
+    char sectionTag[19];
+    char nullByte;
+    unsigned int absoluteDataStart;
+    unsigned int localFixupsOffset;
+    unsigned int globalFixupsOffset;
+    unsigned int virtualFixupsOffset;
+    unsigned int exportsOffset;
+    unsigned int importsOffset;
+    unsigned int endOffset;
+
+    void endianSwap()
+    {
+        Endian::swap(absoluteDataStart);
+        Endian::swap(localFixupsOffset);
+        Endian::swap(globalFixupsOffset);
+        Endian::swap(virtualFixupsOffset);
+        Endian::swap(exportsOffset);
+        Endian::swap(importsOffset);
+        Endian::swap(endOffset);
+    }
+};
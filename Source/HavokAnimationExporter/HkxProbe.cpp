@@ -0,0 +1,338 @@
+#include "Pch.h"
+#include "HkxProbe.h"
+#include "HavokPackfile.h"
+#include "MappedFile.h"
+#include "Parallel.h"
+
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+
+namespace
+{
+    const unsigned int HAVOK_TAGFILE_MAGIC[2] = { 0xCAB00D1E, 0xD011FACE };
+
+    bool checkIsHkxFile(const char* fileName)
+    {
+        const size_t length = strlen(fileName);
+        return length >= 4 && _stricmp(fileName + length - 4, ".hkx") == 0;
+    }
+
+    void listDirectory(const std::string& directoryName, std::vector<std::string>& filePaths, std::vector<std::string>& directoryNames)
+    {
+        WIN32_FIND_DATAA findData;
+
+        HANDLE handle = FindFirstFileA((directoryName + "*").c_str(), &findData);
+        if (handle == INVALID_HANDLE_VALUE)
+            return;
+
+        do
+        {
+            if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            {
+                if (strcmp(findData.cFileName, ".") != 0 && strcmp(findData.cFileName, "..") != 0)
+                    directoryNames.push_back(directoryName + findData.cFileName + "\\");
+            }
+            else if (checkIsHkxFile(findData.cFileName))
+            {
+                filePaths.push_back(directoryName + findData.cFileName);
+            }
+        } while (FindNextFileA(handle, &findData));
+
+        FindClose(handle);
+    }
+
+    // Lists a whole level of the directory tree at once, so wide trees are walked in parallel.
+    std::vector<std::string> findHkxFiles(std::string directoryName)
+    {
+        if (!directoryName.empty() && directoryName.back() != '\\' && directoryName.back() != '/')
+            directoryName += '\\';
+
+        std::vector<std::string> filePaths;
+        std::vector<std::string> directoryNames(1, directoryName);
+
+        std::mutex mutex;
+
+        while (!directoryNames.empty())
+        {
+            std::vector<std::string> subdirectoryNames;
+
+            parallelFor(directoryNames.size(), [&](size_t i)
+            {
+                std::vector<std::string> localFilePaths;
+                std::vector<std::string> localDirectoryNames;
+
+                listDirectory(directoryNames[i], localFilePaths, localDirectoryNames);
+
+                std::lock_guard<std::mutex> lock(mutex);
+                filePaths.insert(filePaths.end(), localFilePaths.begin(), localFilePaths.end());
+                subdirectoryNames.insert(subdirectoryNames.end(), localDirectoryNames.begin(), localDirectoryNames.end());
+            }, false);
+
+            directoryNames = std::move(subdirectoryNames);
+        }
+
+        std::sort(filePaths.begin(), filePaths.end());
+        return filePaths;
+    }
+
+    // Entries are a 4-byte class signature, a tab and a null-terminated name, terminated by 0xFF padding.
+    void readClassNames(const unsigned char* data, size_t dataSize, std::vector<std::string>& classNames)
+    {
+        size_t offset = 0;
+
+        while (offset + 5 < dataSize)
+        {
+            if (data[offset] == 0xFF && data[offset + 1] == 0xFF && data[offset + 2] == 0xFF && data[offset + 3] == 0xFF)
+                break;
+
+            offset += 5;
+
+            const char* name = reinterpret_cast<const char*>(data + offset);
+            const size_t length = strnlen(name, dataSize - offset);
+
+            if (length == 0 || offset + length >= dataSize)
+                break;
+
+            classNames.emplace_back(name, length);
+            offset += length + 1;
+        }
+    }
+
+    std::string escapeJson(const std::string& value)
+    {
+        std::string result;
+
+        for (auto c : value)
+        {
+            if (c == '"' || c == '\\')
+                result += '\\';
+
+            result += c;
+        }
+
+        return result;
+    }
+
+    std::string escapeCsv(const std::string& value)
+    {
+        if (value.find_first_of(",\"\n") == std::string::npos)
+            return value;
+
+        std::string result = "\"";
+
+        for (auto c : value)
+        {
+            if (c == '"')
+                result += '"';
+
+            result += c;
+        }
+
+        return result + "\"";
+    }
+}
+
+bool probeHkx(const char* filePath, HkxProbeResult& result)
+{
+    result.filePath = filePath;
+
+    MappedFile file;
+    if (!file.open(filePath))
+    {
+        result.error = "failed to open";
+        return false;
+    }
+
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(file.data);
+    result.fileSize = file.dataSize;
+
+    if (file.dataSize >= 8 && memcmp(data, HAVOK_TAGFILE_MAGIC, 8) == 0)
+    {
+        // Tagfiles have no fixed header to read further without a full load.
+        result.format = "tagfile";
+        return true;
+    }
+
+    HavokPackfileHeader header;
+    if (file.dataSize < sizeof(header) || memcmp(data, HAVOK_PACKFILE_MAGIC, 8) != 0)
+    {
+        result.error = "not a HKX file";
+        return false;
+    }
+
+    memcpy(&header, data, sizeof(header));
+
+    result.format = "packfile";
+    result.pointerSize = header.layoutRules[0];
+    result.littleEndian = header.layoutRules[1] != 0;
+
+    if (!result.littleEndian)
+    {
+        Endian::swap(header.fileVersion);
+        Endian::swap(header.numSections);
+        Endian::swap(header.maxPredicate);
+        Endian::swap(header.predicateArraySizePlusPadding);
+    }
+
+    result.fileVersion = header.fileVersion;
+    result.contentsVersion.assign(header.contentsVersion, strnlen(header.contentsVersion, sizeof(header.contentsVersion)));
+
+    if (header.fileVersion > HAVOK_PACKFILE_VERSION_2012)
+    {
+        result.error = "unsupported file version";
+        return false;
+    }
+
+    // Havok 2012 packfiles may follow the header with a predicate array, and pad every section header to 64 bytes.
+    size_t sectionHeadersOffset = sizeof(header);
+    size_t sectionHeaderSize = sizeof(HavokPackfileSectionHeader);
+
+    if (header.fileVersion == HAVOK_PACKFILE_VERSION_2012)
+    {
+        if (header.maxPredicate != -1)
+            sectionHeadersOffset += (unsigned short)header.predicateArraySizePlusPadding;
+
+        sectionHeaderSize = HAVOK_PACKFILE_SECTION_HEADER_SIZE_2012;
+    }
+
+    if (header.numSections < 0 || sectionHeadersOffset + header.numSections * sectionHeaderSize > file.dataSize)
+    {
+        result.error = "truncated section headers";
+        return false;
+    }
+
+    for (int i = 0; i < header.numSections; i++)
+    {
+        HavokPackfileSectionHeader sectionHeader;
+        memcpy(&sectionHeader, data + sectionHeadersOffset + i * sectionHeaderSize, sizeof(sectionHeader));
+
+        if (!result.littleEndian)
+            sectionHeader.endianSwap();
+
+        HkxSection section;
+        section.tag.assign(sectionHeader.sectionTag, strnlen(sectionHeader.sectionTag, sizeof(sectionHeader.sectionTag)));
+        section.size = sectionHeader.endOffset;
+
+        result.sections.push_back(section);
+
+        if (section.tag != "__classnames__")
+            continue;
+
+        if ((uint64_t)sectionHeader.absoluteDataStart + sectionHeader.localFixupsOffset > file.dataSize)
+        {
+            result.error = "truncated class names";
+            return false;
+        }
+
+        readClassNames(data + sectionHeader.absoluteDataStart, sectionHeader.localFixupsOffset, result.classNames);
+    }
+
+    for (auto& className : result.classNames)
+    {
+        if (className == "hkaSkeleton")
+            result.hasSkeleton = true;
+
+        else if (className == "hkaAnimationBinding")
+            result.hasAnimations = true;
+    }
+
+    return true;
+}
+
+std::vector<HkxProbeResult> probeHkxFiles(const std::string& path)
+{
+    const DWORD attributes = GetFileAttributesA(path.c_str());
+
+    std::vector<std::string> filePaths;
+
+    if (attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY))
+        filePaths = findHkxFiles(path);
+    else
+        filePaths.push_back(path);
+
+    std::vector<HkxProbeResult> results(filePaths.size());
+
+    // Probing runs before Havok is initialized, and doesn't need it.
+    parallelFor(filePaths.size(), [&](size_t i)
+    {
+        probeHkx(filePaths[i].c_str(), results[i]);
+    }, false);
+
+    return results;
+}
+
+bool saveHkxInventory(const std::string& filePath, const std::vector<HkxProbeResult>& results)
+{
+    const bool json = filePath.size() >= 5 && _stricmp(filePath.c_str() + filePath.size() - 5, ".json") == 0;
+
+    std::string text;
+    char buffer[256];
+
+    if (json)
+    {
+        text += "[\n";
+
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const HkxProbeResult& result = results[i];
+
+            sprintf(buffer, "\", \"size\": %llu, \"fileVersion\": %d, \"pointerSize\": %d, \"littleEndian\": %s, \"hasSkeleton\": %s, \"hasAnimations\": %s",
+                (unsigned long long)result.fileSize, result.fileVersion, result.pointerSize, result.littleEndian ? "true" : "false",
+                result.hasSkeleton ? "true" : "false", result.hasAnimations ? "true" : "false");
+
+            text += "  { \"path\": \"" + escapeJson(result.filePath) + buffer;
+            text += ", \"format\": \"" + result.format + "\", \"contentsVersion\": \"" + escapeJson(result.contentsVersion) + "\", \"error\": \"" + escapeJson(result.error) + "\"";
+
+            text += ", \"sections\": {";
+            for (size_t j = 0; j < result.sections.size(); j++)
+            {
+                sprintf(buffer, "%s\"%s\": %u", j > 0 ? ", " : " ", escapeJson(result.sections[j].tag).c_str(), result.sections[j].size);
+                text += buffer;
+            }
+
+            text += " }, \"classNames\": [";
+            for (size_t j = 0; j < result.classNames.size(); j++)
+                text += (j > 0 ? ", \"" : " \"") + escapeJson(result.classNames[j]) + "\"";
+
+            text += i + 1 < results.size() ? " ] },\n" : " ] }\n";
+        }
+
+        text += "]\n";
+    }
+    else
+    {
+        text += "path,size,format,fileVersion,contentsVersion,pointerSize,littleEndian,sections,hasSkeleton,hasAnimations,classNames,error\n";
+
+        for (auto& result : results)
+        {
+            std::string sections;
+            for (auto& section : result.sections)
+            {
+                sprintf(buffer, "%s%s=%u", sections.empty() ? "" : " ", section.tag.c_str(), section.size);
+                sections += buffer;
+            }
+
+            std::string classNames;
+            for (auto& className : result.classNames)
+                classNames += (classNames.empty() ? "" : " ") + className;
+
+            sprintf(buffer, ",%llu,%s,%d,", (unsigned long long)result.fileSize, result.format.c_str(), result.fileVersion);
+            text += escapeCsv(result.filePath) + buffer + escapeCsv(result.contentsVersion);
+
+            sprintf(buffer, ",%d,%d,", result.pointerSize, result.littleEndian ? 1 : 0);
+            text += buffer + escapeCsv(sections);
+
+            sprintf(buffer, ",%d,%d,", result.hasSkeleton ? 1 : 0, result.hasAnimations ? 1 : 0);
+            text += buffer + escapeCsv(classNames) + "," + escapeCsv(result.error) + "\n";
+        }
+    }
+
+    if (filePath.empty())
+    {
+        fwrite(text.data(), 1, text.size(), stdout);
+        return true;
+    }
+
+    return writeFileAtomic(filePath.c_str(), text.data(), text.size(), false);
+}
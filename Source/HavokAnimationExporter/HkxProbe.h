@@ -0,0 +1,36 @@
+#pragma once
+
+struct HkxSection
+{
+    std::string tag;
+    unsigned int size;
+};
+
+// What a HKX file holds, read from its headers and class name section alone.
+struct HkxProbeResult
+{
+    std::string filePath;
+    uint64_t fileSize = 0;
+
+    // packfile, tagfile, or empty if the file isn't a HKX file.
+    std::string format;
+    std::string error;
+
+    int fileVersion = 0;
+    std::string contentsVersion;
+    int pointerSize = 0;
+    bool littleEndian = false;
+
+    std::vector<HkxSection> sections;
+    std::vector<std::string> classNames;
+    bool hasSkeleton = false;
+    bool hasAnimations = false;
+};
+
+bool probeHkx(const char* filePath, HkxProbeResult& result);
+
+// Probes the file, or every HKX file under the directory. Directories are listed and files are probed in parallel.
+std::vector<HkxProbeResult> probeHkxFiles(const std::string& path);
+
+// CSV, or JSON if the output path ends with .json. Writes to stdout if the output path is empty.
+bool saveHkxInventory(const std::string& filePath, const std::vector<HkxProbeResult>& results);
@@ -1,4 +1,13 @@
 #include "Pch.h"
+#include "Parallel.h"
+#include "BoundedQueue.h"
+#include "PoseBuffer.h"
+#include "PoseCache.h"
+#include "Hash.h"
+#include "MappedFile.h"
+#include "BatchSchedule.h"
+#include "Archive.h"
+#include "HkxProbe.h"
 
 #ifdef _550
 
@@ -44,114 +53,130 @@ static bool checkIsSkeleton(FbxNode* pNode)
     return lAttribute == nullptr || lAttribute->GetAttributeType() == FbxNodeAttribute::eNull || lAttribute->GetAttributeType() == FbxNodeAttribute::eSkeleton;
 }
 
-static void createBonesRecursively(FbxNode* pNode, int parentIndex,
-    hkArray<hkaBone>& bones, hkArray<hkInt16>& parentIndices, hkArray<hkQsTransform>& referencePose, hkArray<bool>& newTags)
+static bool checkHasNewTag(const char* name)
 {
-    if (!checkIsSkeleton(pNode))
-        return;
+    for (const char* c = name; *c != '\0'; c++)
+    {
+        if (*c == '@' && _strnicmp(c + 1, "new", 3) == 0)
+            return true;
+    }
+
+    return false;
+}
 
-    hkaBone bone;
-    bone.m_name = (char*)pNode->GetName();
-    bone.m_lockTranslation = false;
+struct BoneNode
+{
+    FbxNode* pNode;
+    hkInt16 parentIndex;
+};
 
-    const int index = bones.getSize();
+static void collectBones(FbxNode* pRootNode, std::vector<BoneNode>& boneNodes)
+{
+    std::vector<BoneNode> stack;
+    std::vector<FbxNode*> children;
 
-    bones.pushBack(bone);
-    parentIndices.pushBack(parentIndex);
+    if (checkIsSkeleton(pRootNode))
+        stack.push_back({ pRootNode, -1 });
 
-    const FbxAMatrix lLocalTransform = pNode->EvaluateLocalTransform();
+    while (!stack.empty())
+    {
+        const BoneNode boneNode = stack.back();
+        stack.pop_back();
 
-    referencePose.pushBack(toHavok(lLocalTransform));
+        const hkInt16 index = (hkInt16)boneNodes.size();
+        boneNodes.push_back(boneNode);
 
-    std::string name(pNode->GetName());
-    std::transform(name.begin(), name.end(), name.begin(), tolower);
-    newTags.pushBack(name.find("@new") != std::string::npos);
+        // Replicate Havok Content Tools' case insensitive child ordering.
+        children.clear();
 
-    // Replicate Havok Content Tools' case insensitive child ordering.
-    std::vector<FbxNode*> nodes;
+        for (int i = 0; i < boneNode.pNode->GetChildCount(); i++)
+        {
+            FbxNode* lChild = boneNode.pNode->GetChild(i);
 
-    for (int i = 0; i < pNode->GetChildCount(); i++)
-        nodes.push_back(pNode->GetChild(i));
+            if (checkIsSkeleton(lChild))
+                children.push_back(lChild);
+        }
 
-    std::sort(nodes.begin(), nodes.end(), [](auto lhs, auto rhs) { return _stricmp(lhs->GetName(), rhs->GetName()) < 0; });
+        std::sort(children.begin(), children.end(), [](auto lhs, auto rhs) { return _stricmp(lhs->GetName(), rhs->GetName()) < 0; });
 
-    for (auto pNode : nodes)
-        createBonesRecursively(pNode, index, bones, parentIndices, referencePose, newTags);
+        // Push in reverse so children get visited in sorted order, matching a depth-first recursion.
+        for (auto it = children.rbegin(); it != children.rend(); ++it)
+            stack.push_back({ *it, index });
+    }
 }
 
 static hkaSkeleton* createSkeleton(FbxNode* pNode, const char* name)
 {
-    hkaSkeleton* skeleton = new hkaSkeleton();
-    skeleton->m_name = name;
+    std::vector<BoneNode> boneNodes;
+    collectBones(pNode, boneNodes);
 
-    hkArray<hkaBone> bones;
-    hkArray<hkInt16> parentIndices;
-    hkArray<hkQsTransform> referencePose;
-    hkArray<bool> newTags;
+    if (boneNodes.empty())
+        return nullptr;
 
-    createBonesRecursively(pNode, -1, bones, parentIndices, referencePose, newTags);
+    const int boneCount = (int)boneNodes.size();
 
     // Check for bones with @NEW tag, and push them to the end of the list.
     // This can be used to remain compatible with existing animations in games 
     // that map animations to the skeleton by bone index, instead of bone name.
-    hkArray<hkInt16> boneIndices;
-    boneIndices.reserve(bones.getSize());
+    std::vector<hkInt16> boneIndices;
+    boneIndices.reserve(boneCount);
 
-    for (hkInt16 i = 0; i < bones.getSize(); i++)
+    std::vector<bool> newTags(boneCount);
+
+    for (int i = 0; i < boneCount; i++)
     {
+        newTags[i] = checkHasNewTag(boneNodes[i].pNode->GetName());
+
         if (!newTags[i])
-            boneIndices.pushBack(i);
-    }  
-    for (hkInt16 i = 0; i < bones.getSize(); i++)
+            boneIndices.push_back((hkInt16)i);
+    }
+    for (int i = 0; i < boneCount; i++)
     {
         if (newTags[i])
-            boneIndices.pushBack(i);
+            boneIndices.push_back((hkInt16)i);
     }
 
-    hkArray<hkaBone> bonesSorted(bones.getSize());
-    hkArray<hkInt16> parentIndicesSorted(bones.getSize());
-    hkArray<hkQsTransform> referencePoseSorted(bones.getSize());
+    // Inverse permutation to remap parent indices to their sorted positions.
+    std::vector<hkInt16> sortedIndices(boneCount);
+
+    for (int i = 0; i < boneCount; i++)
+        sortedIndices[boneIndices[i]] = (hkInt16)i;
 
-    for (int i = 0; i < bones.getSize(); i++)
+    hkArray<hkaBone> bones(boneCount);
+    hkArray<hkInt16> parentIndices(boneCount);
+    hkArray<hkQsTransform> referencePose(boneCount);
+
+    for (int i = 0; i < boneCount; i++)
     {
-        hkInt16 boneIndex = boneIndices[i];
-        bonesSorted[i] = bones[boneIndex];
-        referencePoseSorted[i] = referencePose[boneIndex];
+        const BoneNode& boneNode = boneNodes[boneIndices[i]];
 
-        hkInt16 parentIndex = parentIndices[boneIndex];
-        if (parentIndex >= 0 && parentIndex != boneIndices[parentIndex])
-        {
-            for (int j = 0; j < boneIndices.getSize(); j++)
-            {
-                if (parentIndex == boneIndices[j])
-                {
-                    parentIndex = j;
-                    break;
-                }
-            }
-        }
+        hkaBone& bone = bones[i];
+        bone.m_name = (char*)boneNode.pNode->GetName();
+        bone.m_lockTranslation = false;
 
-        parentIndicesSorted[i] = parentIndex;
+        parentIndices[i] = boneNode.parentIndex >= 0 ? sortedIndices[boneNode.parentIndex] : (hkInt16)-1;
+        referencePose[i] = toHavok(boneNode.pNode->EvaluateLocalTransform());
     }
 
-#if _2010 || _2012
-    skeleton->m_bones = std::move(bonesSorted);
-    skeleton->m_parentIndices = std::move(parentIndicesSorted);
-    skeleton->m_referencePose = std::move(referencePoseSorted);
+    hkaSkeleton* skeleton = new hkaSkeleton();
+    skeleton->m_name = name;
 
-    return !skeleton->m_bones.isEmpty() ? skeleton : nullptr;
+#if _2010 || _2012
+    skeleton->m_bones = std::move(bones);
+    skeleton->m_parentIndices = std::move(parentIndices);
+    skeleton->m_referencePose = std::move(referencePose);
 #elif _550
-    toPtrArray(bonesSorted, skeleton->m_bones, skeleton->m_numBones);
-    toPtrArray(parentIndicesSorted, skeleton->m_parentIndices, skeleton->m_numParentIndices);
-    toPtrArray(referencePoseSorted, skeleton->m_referencePose, skeleton->m_numReferencePose);
-
-    return !bones.isEmpty() ? skeleton : nullptr;
+    toPtrArray(bones, skeleton->m_bones, skeleton->m_numBones);
+    toPtrArray(parentIndices, skeleton->m_parentIndices, skeleton->m_numParentIndices);
+    toPtrArray(referencePose, skeleton->m_referencePose, skeleton->m_numReferencePose);
 #endif
+
+    return skeleton;
 }
 
 extern std::vector<unsigned char> endianSwapHKX(const void* data, size_t dataSize);
 
-static hkaSkeleton* loadSkeleton(const char* filePath)
+static hkaAnimationContainer* loadAnimationContainer(const char* filePath)
 {
 #if _2010 || _2012
     hkSerializeUtil::ErrorDetails errorDetails;
@@ -191,7 +216,12 @@ static hkaSkeleton* loadSkeleton(const char* filePath)
     if (levelContainer == nullptr)
         return nullptr;
 
-    hkaAnimationContainer* animationContainer = (hkaAnimationContainer*)levelContainer->findObjectByType("hkaAnimationContainer");
+    return (hkaAnimationContainer*)levelContainer->findObjectByType("hkaAnimationContainer");
+}
+
+static hkaSkeleton* loadSkeleton(const char* filePath)
+{
+    hkaAnimationContainer* animationContainer = loadAnimationContainer(filePath);
 
     if (animationContainer == nullptr)
         return nullptr;
@@ -211,286 +241,2993 @@ static void havokErrorReportFunction(const char*, void*)
 {
 }
 
-static hkaAnimationBinding* createAnimationAndBinding(FbxScene* pScene, hkaSkeleton* skeleton, const char* originalSkeletonName, bool compress, double fps)
+static int getBoneCount(const hkaSkeleton* skeleton)
 {
-    FbxAnimStack* pAnimStack = pScene->GetCurrentAnimationStack();
-
-    if (pAnimStack == nullptr)
-        return nullptr;
-
-    const FbxTimeSpan lTimeSpan = pAnimStack->GetLocalTimeSpan();
-    const FbxTime lDuration = lTimeSpan.GetDuration();
-
-    // Align duration to target FPS to prevent flickering with spline compressed animations.
-    double lSecondDouble = lDuration.GetSecondDouble();
-    const FbxLongLong lFrameCount = std::max<FbxLongLong>(1, (FbxLongLong)round(lSecondDouble * fps)) + 1;
-    lSecondDouble = static_cast<double>(lFrameCount - 1) / fps;
-
-    InterleavedUncompressedAnimation* animation = new InterleavedUncompressedAnimation();
-    animation->m_duration = (hkReal)lSecondDouble;
-
-    hkArray<FbxNode*> nodes;
-    hkArray<hkaAnnotationTrack> annotationTracks;
-
 #if _2010 || _2012
-    for (int i = 0; i < skeleton->m_bones.getSize(); i++)
-    {
-        const hkaBone& bone = skeleton->m_bones[i];
-
-        FbxNode* lNode = pScene->FindNodeByName(bone.m_name.cString());
-
-        hkaAnnotationTrack track;
-        track.m_trackName = bone.m_name;
-
+    return skeleton->m_bones.getSize();
 #elif _550
-    for (int i = 0; i < skeleton->m_numBones; i++)
-    {
-        hkaBone* bone = skeleton->m_bones[i];
-
-        FbxNode* lNode = pScene->FindNodeByName(bone->m_name);
+    return skeleton->m_numBones;
+#endif
+}
 
-        hkaAnnotationTrack track {};
-        track.m_name = bone->m_name;
+static const char* getBoneName(const hkaSkeleton* skeleton, int index)
+{
+#if _2010 || _2012
+    return skeleton->m_bones[index].m_name.cString();
+#elif _550
+    return skeleton->m_bones[index]->m_name;
 #endif
+}
 
-        annotationTracks.pushBack(track);
-        nodes.pushBack(lNode);
-    }
+// Samples local poses at the given frames of the current animation stack, where frame i lies i / fps seconds after lStart.
+// Rotations are left as they are, since the frames are not necessarily contiguous.
+static bool sampleFrames(FbxScene* pScene, hkaSkeleton* skeleton, const FbxTime& lStart, double fps, const std::vector<int>& frames, SampledAnimation& sampledAnimation)
+{
+    const int boneCount = getBoneCount(skeleton);
 
-    if (nodes.isEmpty())
-        return nullptr;
+    if (boneCount == 0 || frames.empty())
+        return false;
 
-    hkaAnimationBinding* animationBinding = new hkaAnimationBinding();
+    hkArray<FbxNode*> nodes;
+    hkArray<hkInt16>& transformTrackToBoneIndices = sampledAnimation.transformTrackToBoneIndices;
 
-    hkArray<hkInt16> transformTrackToBoneIndices;
+    transformTrackToBoneIndices.clear();
 
-    for (int i = 0; i < annotationTracks.getSize(); i++)
+    for (int i = 0; i < boneCount; i++)
     {
-        const hkaAnnotationTrack& track = annotationTracks[i];
-
-        int index = -1;
+        const char* name = getBoneName(skeleton, i);
 
-#if _2010 || _2012
-        for (int j = 0; j < skeleton->m_bones.getSize(); j++)
-        {
-            if (track.m_trackName != skeleton->m_bones[j].m_name)
-                continue;
+        nodes.pushBack(pScene->FindNodeByName(name));
 
-            index = j;
-            break;
-        }
+        int index = -1;
 
-#elif _550
-        for (int j = 0; j < skeleton->m_numBones; j++)
+        for (int j = 0; j < boneCount; j++)
         {
-            if (strcmp(track.m_name, skeleton->m_bones[j]->m_name) != 0)
+            if (strcmp(name, getBoneName(skeleton, j)) != 0)
                 continue;
 
             index = j;
             break;
         }
-#endif
 
         transformTrackToBoneIndices.pushBack((hkInt16)index);
     }
 
-#if _2010 || _2012
-    animationBinding->m_transformTrackToBoneIndices = std::move(transformTrackToBoneIndices);
-#elif _550
-    toPtrArray(transformTrackToBoneIndices, animationBinding->m_transformTrackToBoneIndices, animationBinding->m_numTransformTrackToBoneIndices);
-#endif
+    const int frameCount = (int)frames.size();
 
-#if _2010 || _2012
-    animation->m_annotationTracks = std::move(annotationTracks);
-#elif _550
-    toPtrArray(annotationTracks, animation->m_annotationTracks, animation->m_numAnnotationTracks);
-#endif
+    PoseBuffer& poseBuffer = sampledAnimation.poses;
+    poseBuffer.resize(boneCount, frameCount);
 
-    animation->m_numberOfTransformTracks = nodes.getSize();
+    hkArray<hkQsTransform> referenceModelTransforms(boneCount);
+    hkaSkeletonUtils::transformLocalPoseToModelPose(boneCount, &skeleton->m_parentIndices[0], &skeleton->m_referencePose[0], &referenceModelTransforms[0]);
 
-    hkArray<hkQsTransform> localTransforms(nodes.getSize() * (int)lFrameCount);
-    hkArray<hkQsTransform> modelTransforms(nodes.getSize());
+    // FBX evaluation is single threaded, so global transforms get evaluated for a window of frames first.
+    // Conversion to Havok and model to local pose transformation then run for the whole window in parallel.
+    const int windowSize = std::min<int>(frameCount, std::max<int>(1, (32 * 1024 * 1024) / (boneCount * (int)sizeof(FbxAMatrix))));
 
-    hkaSkeletonUtils::transformLocalPoseToModelPose(nodes.getSize(), &skeleton->m_parentIndices[0], &skeleton->m_referencePose[0], &modelTransforms[0]);
+    std::vector<FbxAMatrix> lGlobalTransforms(boneCount * windowSize);
+    hkArray<hkQsTransform> modelTransforms(boneCount * windowSize);
+    hkArray<hkQsTransform> localTransforms(boneCount * windowSize);
 
-    for (FbxLongLong i = 0; i < lFrameCount; i++)
+    for (int windowStart = 0; windowStart < frameCount; windowStart += windowSize)
     {
-        const FbxTime lTime = lTimeSpan.GetStart() + FbxTimeSeconds((double)i / (double)(lFrameCount - 1) * lSecondDouble);
+        const int windowFrameCount = std::min<int>(windowSize, frameCount - windowStart);
 
-        for (int j = 0; j < nodes.getSize(); j++)
+        for (int i = 0; i < windowFrameCount; i++)
         {
-            if (nodes[j] != nullptr)
-                modelTransforms[j] = toHavok(nodes[j]->EvaluateGlobalTransform(lTime));
+            const FbxTime lTime = lStart + FbxTimeSeconds((double)frames[windowStart + i] / fps);
+
+            for (int j = 0; j < boneCount; j++)
+            {
+                if (nodes[j] != nullptr)
+                    lGlobalTransforms[i * boneCount + j] = nodes[j]->EvaluateGlobalTransform(lTime);
+            }
         }
 
-        hkaSkeletonUtils::transformModelPoseToLocalPose(nodes.getSize(), &skeleton->m_parentIndices[0], &modelTransforms[0], &localTransforms[(int)i * nodes.getSize()]);
+        parallelFor(windowFrameCount, [&](size_t i)
+        {
+            const int offset = (int)i * boneCount;
+
+            for (int j = 0; j < boneCount; j++)
+                modelTransforms[offset + j] = nodes[j] != nullptr ? toHavok(lGlobalTransforms[offset + j]) : referenceModelTransforms[j];
+
+            hkaSkeletonUtils::transformModelPoseToLocalPose(boneCount, &skeleton->m_parentIndices[0], &modelTransforms[offset], &localTransforms[offset]);
+
+            poseBuffer.setFrame(windowStart + (int)i, &localTransforms[offset]);
+        });
     }
 
-    // Unroll quaternions so spline compression doesn't flicker.
-    for (FbxLongLong i = 0; i < lFrameCount; i++)
+    return true;
+}
+
+// FBX has no timeline markers, so events are read from keyed user properties on bone nodes, as exported for custom attributes.
+// Every key with a non-zero value within the duration after lStart becomes an annotation on the bone, named after the property,
+// or after the value at the key for enum properties.
+static void readAnnotations(FbxScene* pScene, hkaSkeleton* skeleton, FbxAnimStack* pAnimStack, const FbxTime& lStart, double duration, std::vector<SampledAnnotation>& annotations)
+{
+    FbxAnimLayer* pAnimLayer = pAnimStack->GetMember<FbxAnimLayer>(0);
+
+    if (pAnimLayer == nullptr)
+        return;
+
+    const int boneCount = getBoneCount(skeleton);
+
+    for (int i = 0; i < boneCount; i++)
     {
-        for (int j = 0; j < nodes.getSize(); j++)
+        FbxNode* pNode = pScene->FindNodeByName(getBoneName(skeleton, i));
+
+        if (pNode == nullptr)
+            continue;
+
+        for (FbxProperty lProperty = pNode->GetFirstProperty(); lProperty.IsValid(); lProperty = pNode->GetNextProperty(lProperty))
         {
-            auto& transform = localTransforms[(int)i * nodes.getSize() + j];
-            transform.m_rotation.normalize();
+            if (!lProperty.GetFlag(FbxPropertyFlags::eUserDefined))
+                continue;
 
-            if (i == 0)
-            {
-                if (transform.m_rotation.m_vec(3) < 0.0f)
-                    transform.m_rotation.m_vec.setNeg4(transform.m_rotation.m_vec);
-            }
-            else
+            FbxAnimCurve* pAnimCurve = lProperty.GetCurve(pAnimLayer);
+
+            if (pAnimCurve == nullptr)
+                continue;
+
+            const bool isEnum = lProperty.GetPropertyDataType().GetType() == eFbxEnum;
+
+            for (int j = 0; j < pAnimCurve->KeyGetCount(); j++)
             {
-                auto& prevTransform = localTransforms[(int)(i - 1) * nodes.getSize() + j];
-                if (transform.m_rotation.m_vec.dot4(prevTransform.m_rotation.m_vec) < 0.0f)
-                    transform.m_rotation.m_vec.setNeg4(transform.m_rotation.m_vec);
+                const double time = (pAnimCurve->KeyGetTime(j) - lStart).GetSecondDouble();
+                const int value = (int)round(pAnimCurve->KeyGetValue(j));
+
+                if (value == 0 || time < -0.0001 || time > duration + 0.0001)
+                    continue;
+
+                const char* text = isEnum ? lProperty.GetEnumValue(value) : nullptr;
+
+                SampledAnnotation annotation;
+                annotation.boneIndex = i;
+                annotation.time = (float)std::min<double>(std::max<double>(time, 0.0), duration);
+                annotation.text = text != nullptr ? text : lProperty.GetName().Buffer();
+
+                annotations.push_back(annotation);
             }
         }
     }
+}
 
-#if _2010 || _2012
-    animation->m_transforms = std::move(localTransforms);
-#elif _550
-    toPtrArray(localTransforms, animation->m_transforms, animation->m_numTransforms);
-#endif
+// Number of frames sampled for a duration, aligned to the target FPS to prevent flickering with spline compressed animations.
+static int getFrameCount(double duration, double fps)
+{
+    return std::max<int>(1, (int)round(duration * fps)) + 1;
+}
 
-#if _2010 || _2012
-    animationBinding->m_originalSkeletonName = originalSkeletonName;
-#endif
+static bool sampleAnimation(FbxScene* pScene, hkaSkeleton* skeleton, double fps, SampledAnimation& sampledAnimation)
+{
+    FbxAnimStack* pAnimStack = pScene->GetCurrentAnimationStack();
 
-    SplineCompressedAnimation::TrackCompressionParams params;
-    params.m_rotationTolerance = 0.00001f; // Default value makes it very lossy, so set it to a lower value.
+    if (pAnimStack == nullptr)
+        return false;
 
-    animationBinding->m_animation = compress ? new SplineCompressedAnimation(*animation,
-        params, SplineCompressedAnimation::AnimationCompressionParams()) : (Animation*)animation;
+    const FbxTimeSpan lTimeSpan = pAnimStack->GetLocalTimeSpan();
+    const int frameCount = getFrameCount(lTimeSpan.GetDuration().GetSecondDouble(), fps);
 
-    return animationBinding;
-}
+    sampledAnimation.duration = (double)(frameCount - 1) / fps;
 
-static std::string getFileNameWithoutExtension(std::string filePath)
-{
-    size_t index = filePath.find_last_of("\\/");
-    if (index != std::string::npos)
-        filePath = filePath.substr(index + 1);
+    std::vector<int> frames(frameCount);
+    for (int i = 0; i < frameCount; i++)
+        frames[i] = i;
 
-    index = filePath.find('.');
-    if (index != std::string::npos)
-        filePath = filePath.substr(0, index);
+    if (!sampleFrames(pScene, skeleton, lTimeSpan.GetStart(), fps, frames, sampledAnimation))
+        return false;
 
-    return filePath;
+    readAnnotations(pScene, skeleton, pAnimStack, lTimeSpan.GetStart(), sampledAnimation.duration, sampledAnimation.annotations);
+
+    // Unroll quaternions so spline compression doesn't flicker.
+    sampledAnimation.poses.unrollRotations();
+
+    return true;
 }
 
-static std::string getDirectoryName(const std::string& filePath)
+struct ClipRange
 {
-    return filePath.substr(0, filePath.find_last_of("\\/") + 1);
-}
+    std::string name;
+    FbxAnimStack* pAnimStack;
+
+    // Seconds from the start of the animation stack.
+    double start;
+    double end;
+};
 
-static void savePackfile(const char* dstFilePath, hkRootLevelContainer* levelContainer, const hkStructureLayout& layout)
+// Reads one "name start end" clip per line, with times in seconds from the start of the take.
+// Empty lines and lines starting with # are ignored.
+static bool loadClipRanges(const char* filePath, FbxAnimStack* pAnimStack, std::vector<ClipRange>& clipRanges)
 {
-    hkOstream stream(dstFilePath);
+    FILE* file = fopen(filePath, "r");
+    if (file == nullptr)
+        return false;
 
-    hkBinaryPackfileWriter* writer = new hkBinaryPackfileWriter();
-    writer->setContents(levelContainer, hkRootLevelContainerClass);
+    char line[1024];
+    while (fgets(line, sizeof(line), file) != nullptr)
+    {
+        char name[256];
+        ClipRange clipRange;
 
-    hkBinaryPackfileWriter::Options options = {};
-    options.m_layout = layout;
+        if (sscanf(line, " %255s %lf %lf", name, &clipRange.start, &clipRange.end) != 3 || name[0] == '#')
+            continue;
+
+        clipRange.name = name;
+        clipRange.pAnimStack = pAnimStack;
+
+        clipRanges.push_back(clipRange);
+    }
 
-    writer->save(stream.getStreamWriter(), options);
+    fclose(file);
+    return true;
 }
 
-int main(int argc, const char** argv)
+// Treats every animation stack (take) in the scene as a clip spanning the whole stack.
+static void getTakeClipRanges(FbxScene* pScene, std::vector<ClipRange>& clipRanges)
 {
-    std::string srcFileName;
-    std::string dstFileName;
-    std::string sklFileName;
+    for (int i = 0; i < pScene->GetSrcObjectCount<FbxAnimStack>(); i++)
+    {
+        FbxAnimStack* pAnimStack = pScene->GetSrcObject<FbxAnimStack>(i);
 
-    hkStructureLayout layout =
-#ifdef _550
-        hkStructureLayout::Xbox360LayoutRules;
-#else
-        hkStructureLayout::MsvcWin32LayoutRules;
-#endif
+        ClipRange clipRange;
+        clipRange.name = pAnimStack->GetName();
+        clipRange.pAnimStack = pAnimStack;
+        clipRange.start = 0.0;
+        clipRange.end = pAnimStack->GetLocalTimeSpan().GetDuration().GetSecondDouble();
 
-#if _2010 || _2012
-    bool saveTagfile = false;
-#endif
+        clipRanges.push_back(clipRange);
+    }
+}
 
-    bool compress = true;
-    double fps = 60.0;
+// Samples every clip, sampling each frame shared by clips of the same animation stack only once.
+static bool sampleClips(FbxScene* pScene, hkaSkeleton* skeleton, double fps, const std::vector<ClipRange>& clipRanges, std::vector<SampledAnimation>& sampledAnimations)
+{
+    sampledAnimations.resize(clipRanges.size());
 
-    for (int i = 1; i < argc; i++)
+    std::vector<int> firstFrames(clipRanges.size());
+    std::vector<int> frameCounts(clipRanges.size());
+    std::vector<bool> sampled(clipRanges.size());
+
+    for (size_t i = 0; i < clipRanges.size(); i++)
     {
-        if (strcmp(argv[i], "-s") == 0 || 
-            strcmp(argv[i], "--skl") == 0)
-        {
-            if (i < argc - 1)
-                sklFileName = argv[++i];
-        }
+        if (sampled[i])
+            continue;
 
-        else if (strcmp(argv[i], "-u") == 0 ||
-            strcmp(argv[i], "--uncompressed") == 0)
-        {
-            compress = false;
-        }
+        FbxAnimStack* pAnimStack = clipRanges[i].pAnimStack;
+        pScene->SetCurrentAnimationStack(pAnimStack);
 
-        else if (strcmp(argv[i], "-f") == 0 ||
-            strcmp(argv[i], "--fps") == 0)
-        {
-            fps = atof(argv[++i]);
-        }
+        // Collect the union of frames of every clip on this animation stack.
+        std::vector<int> frames;
 
-#ifdef _550
-        else if (strcmp(argv[i], "-w") == 0 ||
-            strcmp(argv[i], "--windows") == 0)
+        for (size_t j = i; j < clipRanges.size(); j++)
         {
-            layout = hkStructureLayout::MsvcWin32LayoutRules;
-        }
-#endif
+            if (clipRanges[j].pAnimStack != pAnimStack)
+                continue;
 
-        else if (strcmp(argv[i], "-x") == 0 ||
-            strcmp(argv[i], "--xbox360") == 0)
-        {
-            layout = hkStructureLayout::Xbox360LayoutRules;
-        }     
-        
-        else if (strcmp(argv[i], "-p") == 0 ||
-            strcmp(argv[i], "--ps3") == 0)
-        {
-            layout = hkStructureLayout::GccPs3LayoutRules;
+            firstFrames[j] = std::max<int>(0, (int)round(clipRanges[j].start * fps));
+            frameCounts[j] = getFrameCount(clipRanges[j].end - clipRanges[j].start, fps);
+
+            for (int k = 0; k < frameCounts[j]; k++)
+                frames.push_back(firstFrames[j] + k);
         }
 
-#ifdef _2012
-        else if (strcmp(argv[i], "-w") == 0 ||
-            strcmp(argv[i], "--wiiu") == 0)
+        std::sort(frames.begin(), frames.end());
+        frames.erase(std::unique(frames.begin(), frames.end()), frames.end());
+
+        SampledAnimation stackAnimation;
+
+        if (!sampleFrames(pScene, skeleton, pAnimStack->GetLocalTimeSpan().GetStart(), fps, frames, stackAnimation))
+            return false;
+
+        // The frames of a clip are contiguous in the union as well, so each clip is a single range copy.
+        for (size_t j = i; j < clipRanges.size(); j++)
         {
-            layout = hkStructureLayout::GhsWiiULayoutRules;
+            if (clipRanges[j].pAnimStack != pAnimStack)
+                continue;
+
+            SampledAnimation& sampledAnimation = sampledAnimations[j];
+            sampledAnimation.duration = (double)(frameCounts[j] - 1) / fps;
+
+            for (int k = 0; k < stackAnimation.transformTrackToBoneIndices.getSize(); k++)
+                sampledAnimation.transformTrackToBoneIndices.pushBack(stackAnimation.transformTrackToBoneIndices[k]);
+
+            const int sourceFrame = (int)(std::lower_bound(frames.begin(), frames.end(), firstFrames[j]) - frames.begin());
+
+            sampledAnimation.poses.resize(stackAnimation.poses.trackCount, frameCounts[j]);
+            sampledAnimation.poses.copyFrames(0, stackAnimation.poses, sourceFrame, frameCounts[j]);
+            sampledAnimation.poses.unrollRotations();
+
+            readAnnotations(pScene, skeleton, pAnimStack, pAnimStack->GetLocalTimeSpan().GetStart() + FbxTimeSeconds((double)firstFrames[j] / fps),
+                sampledAnimation.duration, sampledAnimation.annotations);
+
+            sampled[j] = true;
         }
-#endif
+    }
+
+    return true;
+}
+
+enum AnnotationMode
+{
+    // No annotation tracks at all.
+    ANNOTATIONS_NONE,
+
+    // Annotation tracks only for bones with annotations.
+    ANNOTATIONS_ANNOTATED,
+
+    // An annotation track per transform track, named after its bone, as Havok's own exporter does.
+    ANNOTATIONS_ALL
+};
+
+struct CompressionSettings
+{
+    bool compress = true;
+
+    // Default rotation tolerance makes it very lossy, so set it to a lower value.
+    // Negative tolerances keep Havok's defaults.
+    float rotationTolerance = 0.00001f;
+    float translationTolerance = -1.0f;
+    float scaleTolerance = -1.0f;
+
+    // When positive, tolerances are scaled up until the compressed data fits in this many bytes.
+    int budget = 0;
+
+    // Compresses long animations in block-aligned parts concurrently, instead of serially.
+    bool blockParallel = false;
+
+    // Checks every block-parallel compression against serial compression, instead of stopping once one matches.
+    bool verify = false;
+
+    // One entry per skeleton bone, set for bones to keep tracks for. Other bones are left out of the animation and its binding.
+    const std::vector<char>* boneMask = nullptr;
 
+    // Leaves out tracks that hold the reference pose within the tolerances on every frame.
+    bool dropStaticTracks = false;
+
+    AnnotationMode annotationMode = ANNOTATIONS_ALL;
+};
+
+static void setAnnotationTracks(Animation* animation, hkArray<hkaAnnotationTrack>& annotationTracks)
+{
 #if _2010 || _2012
-        else if (strcmp(argv[i], "-t") == 0 ||
-            strcmp(argv[i], "--tagfile") == 0)
-        {
-            saveTagfile = true;
-        }
+    animation->m_annotationTracks = std::move(annotationTracks);
+#elif _550
+    toPtrArray(annotationTracks, animation->m_annotationTracks, animation->m_numAnnotationTracks);
 #endif
+}
 
-        else if (srcFileName.empty())
-            srcFileName = argv[i];
+static InterleavedUncompressedAnimation* createUncompressedAnimation(const SampledAnimation& sampledAnimation, hkArray<hkaAnnotationTrack>& annotationTracks)
+{
+    const PoseBuffer& poseBuffer = sampledAnimation.poses;
 
-        else if (dstFileName.empty())
-            dstFileName = argv[i];
+    InterleavedUncompressedAnimation* animation = new InterleavedUncompressedAnimation();
+    animation->m_duration = (hkReal)sampledAnimation.duration;
+
+    setAnnotationTracks(animation, annotationTracks);
+
+    animation->m_numberOfTransformTracks = poseBuffer.trackCount;
+
+    hkArray<hkQsTransform> localTransforms(poseBuffer.trackCount * poseBuffer.frameCount);
+    poseBuffer.getTransforms(&localTransforms[0]);
+
+#if _2010 || _2012
+    animation->m_transforms = std::move(localTransforms);
+#elif _550
+    toPtrArray(localTransforms, animation->m_transforms, animation->m_numTransforms);
+#endif
+
+    return animation;
+}
+
+#if _2010 || _2012
+
+// Keeps the first blockCount blocks of a compressed chunk and appends them to the stitched arrays.
+// Offset arrays may hold several entries per block, which are copied along with their block.
+static void appendBlocks(const SplineCompressedAnimation* chunk, int blockCount, hkArray<hkUint32>& blockOffsets,
+    hkArray<hkUint32>& floatBlockOffsets, hkArray<hkUint32>& transformOffsets, hkArray<hkUint32>& floatOffsets, hkArray<hkUint8>& data)
+{
+    auto appendPerBlock = [&](const hkArray<hkUint32>& source, hkArray<hkUint32>& destination)
+    {
+        const int stride = chunk->m_numBlocks > 0 ? source.getSize() / chunk->m_numBlocks : 0;
+
+        for (int i = 0; i < blockCount * stride; i++)
+            destination.pushBack(source[i]);
+    };
+
+    // Blocks start at 16 byte boundaries.
+    data.setSize(HK_NEXT_MULTIPLE_OF(16, data.getSize()), 0);
+
+    const hkUint32 dataOffset = (hkUint32)data.getSize();
+    const int dataSize = blockCount < chunk->m_numBlocks ? (int)chunk->m_blockOffsets[blockCount] : chunk->m_data.getSize();
+
+    for (int i = 0; i < blockCount; i++)
+        blockOffsets.pushBack(dataOffset + chunk->m_blockOffsets[i]);
+
+    appendPerBlock(chunk->m_floatBlockOffsets, floatBlockOffsets);
+    appendPerBlock(chunk->m_transformOffsets, transformOffsets);
+    appendPerBlock(chunk->m_floatOffsets, floatOffsets);
+
+    data.setSize(dataOffset + dataSize);
+    memcpy(&data[dataOffset], chunk->m_data.begin(), dataSize);
+}
+
+// Spline compression fits every block of frames independently, and consecutive blocks share one frame.
+// Long animations are therefore split into up to chunkCount block-aligned frame ranges, which get compressed concurrently
+// and have their blocks stitched back together in order. Returns nullptr for animations that can't be split.
+// The stitched animation keeps the header of the first part, and the offsets and padding Havok laid out for each part,
+// so it relies on how Havok lays out blocks. compressAnimation checks it against serial compression, and so does testBlockCompression.
+static SplineCompressedAnimation* compressAnimationBlocks(const InterleavedUncompressedAnimation& animation,
+    const SplineCompressedAnimation::TrackCompressionParams& params, const SplineCompressedAnimation::AnimationCompressionParams& animationParams, int chunkCount)
+{
+    const int trackCount = animation.m_numberOfTransformTracks;
+    const int frameCount = trackCount > 0 ? animation.m_transforms.getSize() / trackCount : 0;
+    const int blockStride = animationParams.m_maxFramesPerBlock - 1;
+    const int blockCount = frameCount > 1 && blockStride > 0 ? (frameCount - 2) / blockStride + 1 : 1;
+
+    chunkCount = std::min<int>(blockCount, chunkCount);
+
+    if (chunkCount <= 1 || animation.m_numberOfFloatTracks > 0)
+        return nullptr;
+
+    const int chunkBlockCount = (blockCount + chunkCount - 1) / chunkCount;
+    const hkReal frameDuration = animation.m_duration / (hkReal)(frameCount - 1);
+
+    std::vector<SplineCompressedAnimation*> chunks((blockCount + chunkBlockCount - 1) / chunkBlockCount);
+
+    parallelFor(chunks.size(), [&](size_t i)
+    {
+        const int firstFrame = (int)i * chunkBlockCount * blockStride;
+        const int lastFrame = std::min<int>(firstFrame + chunkBlockCount * blockStride, frameCount - 1);
+
+        InterleavedUncompressedAnimation chunk;
+        chunk.m_duration = (hkReal)(lastFrame - firstFrame) * frameDuration;
+        chunk.m_numberOfTransformTracks = trackCount;
+        chunk.m_transforms.setSize((lastFrame - firstFrame + 1) * trackCount);
+
+        for (int j = 0; j < chunk.m_transforms.getSize(); j++)
+            chunk.m_transforms[j] = animation.m_transforms[firstFrame * trackCount + j];
+
+        // The first chunk becomes the stitched animation, so it carries the annotations.
+        if (i == 0)
+        {
+            for (int j = 0; j < animation.m_annotationTracks.getSize(); j++)
+                chunk.m_annotationTracks.pushBack(animation.m_annotationTracks[j]);
+        }
+
+        chunks[i] = new SplineCompressedAnimation(chunk, params, animationParams);
+    });
+
+    hkArray<hkUint32> blockOffsets;
+    hkArray<hkUint32> floatBlockOffsets;
+    hkArray<hkUint32> transformOffsets;
+    hkArray<hkUint32> floatOffsets;
+    hkArray<hkUint8> data;
+
+    for (size_t i = 0; i < chunks.size(); i++)
+    {
+        const int chunkBlocks = i + 1 < chunks.size() ? std::min<int>(chunkBlockCount, chunks[i]->m_numBlocks) : chunks[i]->m_numBlocks;
+        appendBlocks(chunks[i], chunkBlocks, blockOffsets, floatBlockOffsets, transformOffsets, floatOffsets, data);
+    }
+
+    SplineCompressedAnimation* result = chunks[0];
+    result->m_duration = animation.m_duration;
+    result->m_numFrames = frameCount;
+    result->m_numBlocks = blockOffsets.getSize();
+    result->m_blockOffsets = std::move(blockOffsets);
+    result->m_floatBlockOffsets = std::move(floatBlockOffsets);
+    result->m_transformOffsets = std::move(transformOffsets);
+    result->m_floatOffsets = std::move(floatOffsets);
+    result->m_data = std::move(data);
+
+    for (size_t i = 1; i < chunks.size(); i++)
+        chunks[i]->removeReference();
+
+    return result;
+}
+
+template<typename T>
+static bool checkIsSameArray(const hkArray<T>& lhs, const hkArray<T>& rhs)
+{
+    return lhs.getSize() == rhs.getSize() && memcmp(lhs.begin(), rhs.begin(), lhs.getSize() * sizeof(T)) == 0;
+}
+
+// Compares every serialized member of the compressed animations, except for the annotation tracks, which are copied as is.
+static bool checkIsSameCompression(const SplineCompressedAnimation* lhs, const SplineCompressedAnimation* rhs)
+{
+    return lhs->m_duration == rhs->m_duration &&
+        lhs->m_numberOfTransformTracks == rhs->m_numberOfTransformTracks &&
+        lhs->m_numberOfFloatTracks == rhs->m_numberOfFloatTracks &&
+        lhs->m_numFrames == rhs->m_numFrames &&
+        lhs->m_numBlocks == rhs->m_numBlocks &&
+        lhs->m_maxFramesPerBlock == rhs->m_maxFramesPerBlock &&
+        lhs->m_maskAndQuantizationSize == rhs->m_maskAndQuantizationSize &&
+        lhs->m_blockDuration == rhs->m_blockDuration &&
+        lhs->m_blockInverseDuration == rhs->m_blockInverseDuration &&
+        lhs->m_frameDuration == rhs->m_frameDuration &&
+        lhs->m_endian == rhs->m_endian &&
+        checkIsSameArray(lhs->m_blockOffsets, rhs->m_blockOffsets) &&
+        checkIsSameArray(lhs->m_floatBlockOffsets, rhs->m_floatBlockOffsets) &&
+        checkIsSameArray(lhs->m_transformOffsets, rhs->m_transformOffsets) &&
+        checkIsSameArray(lhs->m_floatOffsets, rhs->m_floatOffsets) &&
+        checkIsSameArray(lhs->m_data, rhs->m_data);
+}
+
+// Compresses generated animations of several blocks both block-parallel and serially, with frame counts ending on partial
+// and full blocks, split into even and uneven parts, and reports every case where the results differ.
+// Returns whether all of them matched.
+static bool testBlockCompression()
+{
+    const SplineCompressedAnimation::TrackCompressionParams params;
+    const SplineCompressedAnimation::AnimationCompressionParams animationParams;
+
+    const int trackCount = 8;
+    const int blockStride = animationParams.m_maxFramesPerBlock - 1;
+    const int frameCounts[] = { blockStride + 2, blockStride * 2 + 1, blockStride * 3 + 2, blockStride * 7 + 5, blockStride * 16 + 1 };
+    const int chunkCounts[] = { 2, 3, 4, 8 };
+
+    int testedCount = 0;
+    int failedCount = 0;
+
+    for (int frameCount : frameCounts)
+    {
+        InterleavedUncompressedAnimation animation;
+        animation.m_duration = (hkReal)(frameCount - 1) / 30.0f;
+        animation.m_numberOfTransformTracks = trackCount;
+        animation.m_transforms.setSize(frameCount * trackCount);
+
+        for (int i = 0; i < frameCount; i++)
+        {
+            const float time = (float)i / 30.0f;
+
+            for (int j = 0; j < trackCount; j++)
+            {
+                hkQsTransform& transform = animation.m_transforms[i * trackCount + j];
+                transform.setIdentity();
+
+                // Every fourth track holds still, so blocks mix static and animated tracks.
+                if (j % 4 == 3)
+                    continue;
+
+                const hkVector4 axis((hkReal)(j % 3 == 0), (hkReal)(j % 3 == 1), (hkReal)(j % 3 == 2));
+                transform.m_rotation.setAxisAngle(axis, sinf(time * (1.0f + j)));
+                transform.m_translation.set(sinf(time * 2.0f + j), cosf(time * 0.5f * j), time, 0.0f);
+            }
+        }
+
+        SplineCompressedAnimation* serialAnimation = new SplineCompressedAnimation(animation, params, animationParams);
+
+        for (int chunkCount : chunkCounts)
+        {
+            SplineCompressedAnimation* blockAnimation = compressAnimationBlocks(animation, params, animationParams, chunkCount);
+            if (blockAnimation == nullptr)
+                continue;
+
+            testedCount++;
+
+            if (!checkIsSameCompression(blockAnimation, serialAnimation))
+            {
+                printf("ERROR: %d frames compressed in %d parts differ from serial compression.\n", frameCount, chunkCount);
+                failedCount++;
+            }
+
+            blockAnimation->removeReference();
+        }
+
+        serialAnimation->removeReference();
+    }
+
+    printf("Block-parallel compression matched serial compression in %d of %d cases.\n", testedCount - failedCount, testedCount);
+
+    return failedCount == 0;
+}
+
+enum BlockCompressionState
+{
+    BLOCK_COMPRESSION_UNCHECKED,
+    BLOCK_COMPRESSION_MATCHED,
+    BLOCK_COMPRESSION_DIFFERED
+};
+
+// Whether block-parallel compression has matched serial compression during this run.
+static std::atomic<int> blockCompressionState(BLOCK_COMPRESSION_UNCHECKED);
+
+#endif
+
+static SplineCompressedAnimation* compressAnimation(const InterleavedUncompressedAnimation& animation, const CompressionSettings& settings)
+{
+    SplineCompressedAnimation::TrackCompressionParams params;
+
+    if (settings.rotationTolerance >= 0.0f)
+        params.m_rotationTolerance = settings.rotationTolerance;
+
+    if (settings.translationTolerance >= 0.0f)
+        params.m_translationTolerance = settings.translationTolerance;
+
+    if (settings.scaleTolerance >= 0.0f)
+        params.m_scaleTolerance = settings.scaleTolerance;
+
+    const SplineCompressedAnimation::AnimationCompressionParams animationParams;
+
+#if _2010 || _2012
+    SplineCompressedAnimation* blockAnimation = nullptr;
+
+    if (settings.blockParallel && blockCompressionState != BLOCK_COMPRESSION_DIFFERED)
+        blockAnimation = compressAnimationBlocks(animation, params, animationParams, (int)getWorkerCount());
+
+    if (blockAnimation == nullptr)
+        return new SplineCompressedAnimation(animation, params, animationParams);
+
+    // Animations are compared until one matches, so no stitched animation is saved before the first comparison.
+    if (blockCompressionState == BLOCK_COMPRESSION_MATCHED && !settings.verify)
+        return blockAnimation;
+
+    SplineCompressedAnimation* serialAnimation = new SplineCompressedAnimation(animation, params, animationParams);
+
+    if (checkIsSameCompression(blockAnimation, serialAnimation))
+    {
+        int expectedState = BLOCK_COMPRESSION_UNCHECKED;
+        blockCompressionState.compare_exchange_strong(expectedState, BLOCK_COMPRESSION_MATCHED);
+
+        serialAnimation->removeReference();
+        return blockAnimation;
+    }
+
+    if (blockCompressionState.exchange(BLOCK_COMPRESSION_DIFFERED) != BLOCK_COMPRESSION_DIFFERED)
+        printf("WARNING: Block-parallel compression differs from serial compression. Serial compression is used from now on.\n");
+
+    blockAnimation->removeReference();
+    return serialAnimation;
+#elif _550
+    return new SplineCompressedAnimation(animation, params, animationParams);
+#endif
+}
+
+// A compressed animation, when given, is used instead of compressing the sampled animation again.
+static Animation* createAnimation(const SampledAnimation& sampledAnimation, hkArray<hkaAnnotationTrack>& annotationTracks, const CompressionSettings& settings,
+    SplineCompressedAnimation* compressedAnimation = nullptr)
+{
+    if (compressedAnimation != nullptr)
+    {
+        setAnnotationTracks(compressedAnimation, annotationTracks);
+        return compressedAnimation;
+    }
+
+    InterleavedUncompressedAnimation* animation = createUncompressedAnimation(sampledAnimation, annotationTracks);
+
+    if (!settings.compress)
+        return animation;
+
+    SplineCompressedAnimation* compressedAnimation = compressAnimation(*animation, settings);
+    animation->removeReference();
+
+    return compressedAnimation;
+}
+
+static hkaAnnotationTrack createAnnotationTrack(const hkaSkeleton* skeleton, int boneIndex, const std::vector<const SampledAnnotation*>& sampledAnnotations)
+{
+    const char* name = getBoneName(skeleton, boneIndex);
+
+    hkArray<hkaAnnotationTrack::Annotation> annotations;
+
+    for (auto sampledAnnotation : sampledAnnotations)
+    {
+#if _2010 || _2012
+        hkaAnnotationTrack::Annotation annotation;
+        annotation.m_text = sampledAnnotation->text.c_str();
+#elif _550
+        hkaAnnotationTrack::Annotation annotation {};
+        annotation.m_text = hkString::strDup(sampledAnnotation->text.c_str());
+#endif
+        annotation.m_time = (hkReal)sampledAnnotation->time;
+
+        annotations.pushBack(annotation);
+    }
+
+#if _2010 || _2012
+    hkaAnnotationTrack track;
+    track.m_trackName = name;
+    track.m_annotations = std::move(annotations);
+#elif _550
+    hkaAnnotationTrack track {};
+    track.m_name = (char*)name;
+    toPtrArray(annotations, track.m_annotations, track.m_numAnnotations);
+#endif
+
+    return track;
+}
+
+// Annotation tracks for the annotation mode. Havok pairs annotation track i with transform track i, so with annotated tracks only,
+// the tracks still run in transform track order up to the last one with annotations, and the ones before it without any are left empty.
+// Annotations on bones without a transform track have nowhere to go, and are left out.
+static void createAnnotationTracks(const SampledAnimation& sampledAnimation, const hkaSkeleton* skeleton, AnnotationMode annotationMode, hkArray<hkaAnnotationTrack>& annotationTracks)
+{
+    if (annotationMode == ANNOTATIONS_NONE)
+        return;
+
+    std::map<int, std::vector<const SampledAnnotation*>> boneAnnotations;
+
+    for (auto& annotation : sampledAnimation.annotations)
+        boneAnnotations[annotation.boneIndex].push_back(&annotation);
+
+    for (auto& annotations : boneAnnotations)
+    {
+        std::stable_sort(annotations.second.begin(), annotations.second.end(), [](const SampledAnnotation* lhs, const SampledAnnotation* rhs)
+        {
+            return lhs->time < rhs->time;
+        });
+    }
+
+    const int trackCount = sampledAnimation.transformTrackToBoneIndices.getSize();
+    int annotationTrackCount = annotationMode == ANNOTATIONS_ALL ? trackCount : 0;
+
+    for (int i = 0; i < trackCount; i++)
+    {
+        if (boneAnnotations.find(sampledAnimation.transformTrackToBoneIndices[i]) != boneAnnotations.end())
+            annotationTrackCount = std::max<int>(annotationTrackCount, i + 1);
+    }
+
+    for (int i = 0; i < annotationTrackCount; i++)
+    {
+        const int boneIndex = sampledAnimation.transformTrackToBoneIndices[i];
+
+        auto annotations = boneAnnotations.find(boneIndex);
+        if (annotations == boneAnnotations.end())
+        {
+            annotationTracks.pushBack(createAnnotationTrack(skeleton, boneIndex, {}));
+            continue;
+        }
+
+        annotationTracks.pushBack(createAnnotationTrack(skeleton, boneIndex, annotations->second));
+        boneAnnotations.erase(annotations);
+    }
+
+    for (auto& annotations : boneAnnotations)
+        printf("WARNING: %d annotations on bone %s were left out, as the bone has no transform track.\n", (int)annotations.second.size(), getBoneName(skeleton, annotations.first));
+}
+
+static hkaAnimationBinding* createAnimationAndBinding(const SampledAnimation& sampledAnimation, hkaSkeleton* skeleton, const char* originalSkeletonName, const CompressionSettings& settings,
+    SplineCompressedAnimation* compressedAnimation = nullptr)
+{
+    hkArray<hkaAnnotationTrack> annotationTracks;
+    createAnnotationTracks(sampledAnimation, skeleton, settings.annotationMode, annotationTracks);
+
+    hkaAnimationBinding* animationBinding = new hkaAnimationBinding();
+
+    hkArray<hkInt16> transformTrackToBoneIndices;
+
+    for (int i = 0; i < sampledAnimation.transformTrackToBoneIndices.getSize(); i++)
+        transformTrackToBoneIndices.pushBack(sampledAnimation.transformTrackToBoneIndices[i]);
+
+#if _2010 || _2012
+    animationBinding->m_transformTrackToBoneIndices = std::move(transformTrackToBoneIndices);
+    animationBinding->m_originalSkeletonName = originalSkeletonName;
+#elif _550
+    toPtrArray(transformTrackToBoneIndices, animationBinding->m_transformTrackToBoneIndices, animationBinding->m_numTransformTrackToBoneIndices);
+#endif
+
+    Animation* animation = createAnimation(sampledAnimation, annotationTracks, settings, compressedAnimation);
+    animationBinding->m_animation = animation;
+
+#if _2010 || _2012
+    // The binding holds the only reference, so the animation is released along with it.
+    animation->removeReference();
+#endif
+
+    if (sampledAnimation.additive)
+    {
+        // Deltas are computed as base^-1 * pose, which newer versions only blend as expected with the deprecated hint.
+#ifdef _2012
+        animationBinding->m_blendHint = hkaAnimationBinding::ADDITIVE_DEPRECATED;
+#else
+        animationBinding->m_blendHint = hkaAnimationBinding::ADDITIVE;
+#endif
+    }
+
+    return animationBinding;
+}
+
+// Releases a binding created with createAnimationAndBinding, along with its animation.
+static void releaseAnimationBinding(hkaAnimationBinding* animationBinding)
+{
+#if _2010 || _2012
+    animationBinding->removeReference();
+#elif _550
+    animationBinding->m_animation->removeReference();
+    delete[] animationBinding->m_transformTrackToBoneIndices;
+    delete animationBinding;
+#endif
+}
+
+#ifdef _550
+
+// Dereferences array elements regardless of whether the array stores objects or pointers to them.
+template<typename T>
+static T& getElement(T& element)
+{
+    return element;
+}
+
+template<typename T>
+static T& getElement(T* element)
+{
+    return *element;
+}
+
+#endif
+
+// Samples an existing animation back to local poses at its original frame rate.
+static bool resampleAnimation(const Animation* animation, const hkaAnimationBinding* animationBinding, SampledAnimation& sampledAnimation)
+{
+    const int trackCount = animation->m_numberOfTransformTracks;
+    const int frameCount = std::max<int>(1, animation->getNumOriginalFrames());
+
+    if (trackCount == 0)
+        return false;
+
+    sampledAnimation.duration = animation->m_duration;
+
+    hkArray<hkInt16>& transformTrackToBoneIndices = sampledAnimation.transformTrackToBoneIndices;
+    transformTrackToBoneIndices.setSize(trackCount);
+
+#if _2010 || _2012
+    const int bindingTrackCount = animationBinding != nullptr ? animationBinding->m_transformTrackToBoneIndices.getSize() : 0;
+#elif _550
+    const int bindingTrackCount = animationBinding != nullptr ? animationBinding->m_numTransformTrackToBoneIndices : 0;
+#endif
+
+    for (int i = 0; i < trackCount; i++)
+        transformTrackToBoneIndices[i] = i < bindingTrackCount ? animationBinding->m_transformTrackToBoneIndices[i] : (hkInt16)i;
+
+    sampledAnimation.additive = animationBinding != nullptr && animationBinding->m_blendHint != hkaAnimationBinding::NORMAL;
+
+    PoseBuffer& poseBuffer = sampledAnimation.poses;
+    poseBuffer.resize(trackCount, frameCount);
+
+    const int floatTrackCount = std::max<int>(1, animation->m_numberOfFloatTracks);
+
+    parallelFor(frameCount, [&](size_t i)
+    {
+        hkArray<hkQsTransform> transforms(trackCount);
+        hkArray<hkReal> floats(floatTrackCount);
+
+        const hkReal time = frameCount > 1 ? (hkReal)((double)i / (double)(frameCount - 1) * sampledAnimation.duration) : 0.0f;
+
+#ifdef _2012
+        animation->sampleTracks(time, &transforms[0], &floats[0]);
+#else
+        animation->sampleTracks(time, &transforms[0], &floats[0], HK_NULL);
+#endif
+
+        poseBuffer.setFrame((int)i, &transforms[0]);
+    });
+
+    // Unroll quaternions so spline compression doesn't flicker.
+    poseBuffer.unrollRotations();
+
+    return true;
+}
+
+// Size of the compressed spline data, which is what budgets are measured in. The animation header,
+// block offset tables, annotations and binding add a comparatively small overhead on top.
+static int getCompressedSize(const SplineCompressedAnimation* animation)
+{
+#if _2010 || _2012
+    return animation->m_data.getSize();
+#elif _550
+    return animation->m_numData;
+#endif
+}
+
+// Returns the settings with every tolerance multiplied by the scale. Unset tolerances start from 0.0001.
+static CompressionSettings scaleTolerances(const CompressionSettings& settings, float scale)
+{
+    CompressionSettings scaledSettings = settings;
+    scaledSettings.rotationTolerance = (settings.rotationTolerance >= 0.0f ? settings.rotationTolerance : 0.0001f) * scale;
+    scaledSettings.translationTolerance = (settings.translationTolerance >= 0.0f ? settings.translationTolerance : 0.0001f) * scale;
+    scaledSettings.scaleTolerance = (settings.scaleTolerance >= 0.0f ? settings.scaleTolerance : 0.0001f) * scale;
+    scaledSettings.budget = 0;
+
+    return scaledSettings;
+}
+
+// Finds the most accurate settings at which the animations fit the budget in total, and returns the animations
+// compressed at those settings, without annotation tracks, in compressedAnimations. Tolerances are scaled by powers of two
+// up to 2^15. Compressed sizes shrink as tolerances grow, so the scale is binary searched, starting from the unscaled
+// tolerances as they fit most of the time. Every animation of a trial is compressed concurrently.
+static CompressionSettings fitCompressionBudget(const char* name, const std::vector<const SampledAnimation*>& sampledAnimations, const CompressionSettings& settings,
+    std::vector<SplineCompressedAnimation*>& compressedAnimations)
+{
+    compressedAnimations.clear();
+
+    if (!settings.compress || settings.budget <= 0 || sampledAnimations.empty())
+        return settings;
+
+    const int scaleCount = 16;
+    const size_t animationCount = sampledAnimations.size();
+
+    std::vector<InterleavedUncompressedAnimation*> animations(animationCount);
+
+    parallelFor(animationCount, [&](size_t i)
+    {
+        hkArray<hkaAnnotationTrack> annotationTracks;
+        animations[i] = createUncompressedAnimation(*sampledAnimations[i], annotationTracks);
+    });
+
+    auto releaseAnimations = [](std::vector<SplineCompressedAnimation*>& trialAnimations)
+    {
+        for (auto animation : trialAnimations)
+            animation->removeReference();
+
+        trialAnimations.clear();
+    };
+
+    int low = 0;
+    int high = scaleCount - 1;
+    int scaleIndex = 0;
+
+    int fittedScaleIndex = scaleCount - 1;
+    int fittedSize = 0;
+
+    while (low <= high)
+    {
+        const CompressionSettings trialSettings = scaleTolerances(settings, (float)(1 << scaleIndex));
+
+        std::vector<SplineCompressedAnimation*> trialAnimations(animationCount);
+
+        parallelFor(animationCount, [&](size_t i)
+        {
+            trialAnimations[i] = compressAnimation(*animations[i], trialSettings);
+        });
+
+        int totalSize = 0;
+
+        for (auto animation : trialAnimations)
+            totalSize += getCompressedSize(animation);
+
+        // The highest scale is always tried last when nothing fits, and is kept as the closest result.
+        if (totalSize <= settings.budget || scaleIndex == scaleCount - 1)
+        {
+            releaseAnimations(compressedAnimations);
+            compressedAnimations = std::move(trialAnimations);
+
+            fittedScaleIndex = scaleIndex;
+            fittedSize = totalSize;
+        }
+        else
+        {
+            releaseAnimations(trialAnimations);
+        }
+
+        if (totalSize <= settings.budget)
+            high = scaleIndex - 1;
+        else
+            low = scaleIndex + 1;
+
+        scaleIndex = (low + high) / 2;
+    }
+
+    for (auto animation : animations)
+        animation->removeReference();
+
+    if (fittedSize > settings.budget)
+        printf("WARNING: %s: Animation data does not fit in %d bytes even at the highest tolerances.\n", name, settings.budget);
+
+    const CompressionSettings fittedSettings = scaleTolerances(settings, (float)(1 << fittedScaleIndex));
+
+    printf("%s: Budget: %d bytes, compressed to %d bytes with rotation tolerance %g, translation tolerance %g, scale tolerance %g\n",
+        name, settings.budget, fittedSize, fittedSettings.rotationTolerance, fittedSettings.translationTolerance, fittedSettings.scaleTolerance);
+
+    return fittedSettings;
+}
+
+// Reports the largest rotation (in degrees) and translation difference between the compressed animation and its source.
+static void printCompressionError(const char* name, const Animation* animation, const SampledAnimation& sampledAnimation)
+{
+    SampledAnimation compressedAnimation;
+
+    if (!resampleAnimation(animation, nullptr, compressedAnimation) ||
+        compressedAnimation.poses.trackCount != sampledAnimation.poses.trackCount ||
+        compressedAnimation.poses.frameCount != sampledAnimation.poses.frameCount)
+        return;
+
+    const PoseBuffer& expected = sampledAnimation.poses;
+    const PoseBuffer& actual = compressedAnimation.poses;
+
+    double rotationError = 0.0;
+    double translationError = 0.0;
+
+    for (int i = 0; i < expected.trackCount * expected.frameCount; i++)
+    {
+        const double dot = fabs(
+            (double)expected.rotationX[i] * actual.rotationX[i] +
+            (double)expected.rotationY[i] * actual.rotationY[i] +
+            (double)expected.rotationZ[i] * actual.rotationZ[i] +
+            (double)expected.rotationW[i] * actual.rotationW[i]);
+
+        rotationError = std::max<double>(rotationError, 2.0 * acos(std::min<double>(1.0, dot)));
+
+        const double x = (double)expected.translations[i](0) - actual.translations[i](0);
+        const double y = (double)expected.translations[i](1) - actual.translations[i](1);
+        const double z = (double)expected.translations[i](2) - actual.translations[i](2);
+
+        translationError = std::max<double>(translationError, sqrt(x * x + y * y + z * z));
+    }
+
+    printf("%s: Max error: %g degrees, %g units\n", name, rotationError * 180.0 / 3.14159265358979323846, translationError);
+}
+
+// Creates the animation and binding of a single clip, reusing the compression that fit the budget if there is one.
+static hkaAnimationBinding* createFittedAnimationAndBinding(const char* name, const SampledAnimation& sampledAnimation, hkaSkeleton* skeleton,
+    const char* originalSkeletonName, const CompressionSettings& settings)
+{
+    std::vector<SplineCompressedAnimation*> compressedAnimations;
+    const CompressionSettings fittedSettings = fitCompressionBudget(name, { &sampledAnimation }, settings, compressedAnimations);
+
+    hkaAnimationBinding* animationBinding = createAnimationAndBinding(sampledAnimation, skeleton, originalSkeletonName, fittedSettings,
+        compressedAnimations.empty() ? nullptr : compressedAnimations[0]);
+
+    if (settings.budget > 0)
+        printCompressionError(name, animationBinding->m_animation, sampledAnimation);
+
+    return animationBinding;
+}
+
+static bool checkIsWildcardMatch(const char* pattern, const char* name)
+{
+    if (*pattern == '*')
+        return checkIsWildcardMatch(pattern + 1, name) || (*name != '\0' && checkIsWildcardMatch(pattern, name + 1));
+
+    if (*name == '\0')
+        return *pattern == '\0';
+
+    return (*pattern == '?' || tolower(*pattern) == tolower(*name)) && checkIsWildcardMatch(pattern + 1, name + 1);
+}
+
+// Every line holds a bone name pattern, where * and ? are wildcards. A trailing / selects every bone
+// under the matching bones as well, and a leading ! removes bones instead. Lines apply in order,
+// starting with no bones, or every bone if the first line removes bones.
+static bool loadBoneMask(const char* filePath, const hkaSkeleton* skeleton, std::vector<char>& boneMask)
+{
+    FILE* file = fopen(filePath, "r");
+    if (file == nullptr)
+        return false;
+
+    const int boneCount = getBoneCount(skeleton);
+
+    boneMask.clear();
+
+    char line[1024];
+    while (fgets(line, sizeof(line), file) != nullptr)
+    {
+        std::string pattern(line);
+
+        const size_t begin = pattern.find_first_not_of(" \t\r\n");
+        if (begin == std::string::npos || pattern[begin] == '#')
+            continue;
+
+        pattern = pattern.substr(begin, pattern.find_last_not_of(" \t\r\n") - begin + 1);
+
+        const std::string entry = pattern;
+
+        const bool remove = pattern.front() == '!';
+        if (remove)
+            pattern.erase(0, 1);
+
+        const bool subtree = !pattern.empty() && (pattern.back() == '/' || pattern.back() == '\\');
+        if (subtree)
+            pattern.pop_back();
+
+        if (boneMask.empty())
+            boneMask.assign(boneCount, remove ? 1 : 0);
+
+        bool matched = false;
+
+        // Bones are matched against their own name, and for subtrees, the names of their ancestors as well.
+        for (int i = 0; i < boneCount; i++)
+        {
+            for (int j = i; j >= 0; j = subtree ? skeleton->m_parentIndices[j] : -1)
+            {
+                if (!checkIsWildcardMatch(pattern.c_str(), getBoneName(skeleton, j)))
+                    continue;
+
+                boneMask[i] = remove ? 0 : 1;
+                matched = true;
+                break;
+            }
+        }
+
+        // Usually a typo or a bone that was renamed, which would otherwise silently change what the mask keeps.
+        if (!matched)
+            printf("WARNING: Bone mask entry \"%s\" matches no bone in the skeleton.\n", entry.c_str());
+    }
+
+    fclose(file);
+
+    if (boneMask.empty())
+        boneMask.assign(boneCount, 1);
+
+    return true;
+}
+
+// Loads the bone mask file, if one was given, and points the settings at the loaded mask.
+static bool applyBoneMask(const std::string& filePath, const hkaSkeleton* skeleton, std::vector<char>& boneMask, CompressionSettings& settings)
+{
+    if (filePath.empty())
+        return true;
+
+    if (!loadBoneMask(filePath.c_str(), skeleton, boneMask))
+        return false;
+
+    settings.boneMask = &boneMask;
+    return true;
+}
+
+// Leaves out the tracks of bones outside the bone mask, and with dropStaticTracks, those that hold the reference pose throughout.
+// At least one track is kept, so the animation stays valid.
+static void maskTracks(SampledAnimation& sampledAnimation, const hkaSkeleton* skeleton, const CompressionSettings& settings)
+{
+    if (settings.boneMask == nullptr && !settings.dropStaticTracks)
+        return;
+
+    const CompressionSettings tolerances = scaleTolerances(settings, 1.0f);
+    const PoseBuffer& poses = sampledAnimation.poses;
+
+    // Additive tracks that add nothing hold the identity instead.
+    hkQsTransform identity;
+    identity.setIdentity();
+
+    std::vector<int> keptTracks;
+
+    for (int i = 0; i < poses.trackCount; i++)
+    {
+        const int boneIndex = sampledAnimation.transformTrackToBoneIndices[i];
+
+        if (settings.boneMask != nullptr && (boneIndex < 0 || !(*settings.boneMask)[boneIndex]))
+            continue;
+
+        if (settings.dropStaticTracks && boneIndex >= 0 && poses.checkIsTrackConstant(i, sampledAnimation.additive ? identity : skeleton->m_referencePose[boneIndex],
+            tolerances.rotationTolerance, tolerances.translationTolerance, tolerances.scaleTolerance))
+            continue;
+
+        keptTracks.push_back(i);
+    }
+
+    if (keptTracks.size() == (size_t)poses.trackCount)
+        return;
+
+    if (keptTracks.empty())
+        keptTracks.push_back(0);
+
+    SampledAnimation maskedAnimation;
+    maskedAnimation.duration = sampledAnimation.duration;
+    maskedAnimation.annotations = std::move(sampledAnimation.annotations);
+    maskedAnimation.additive = sampledAnimation.additive;
+    maskedAnimation.poses.resize((int)keptTracks.size(), poses.frameCount);
+
+    for (size_t i = 0; i < keptTracks.size(); i++)
+    {
+        maskedAnimation.transformTrackToBoneIndices.pushBack(sampledAnimation.transformTrackToBoneIndices[keptTracks[i]]);
+        maskedAnimation.poses.copyTrack((int)i, poses, keptTracks[i]);
+    }
+
+    sampledAnimation = std::move(maskedAnimation);
+}
+
+// Replaces every animation in the container with one resampled and recompressed using the given settings.
+// Returns the number of animations that were replaced.
+static int recompressAnimations(hkaAnimationContainer* animationContainer, const CompressionSettings& settings)
+{
+#if _2010 || _2012
+    const int animationCount = animationContainer->m_animations.getSize();
+    const int bindingCount = animationContainer->m_bindings.getSize();
+#elif _550
+    const int animationCount = animationContainer->m_numAnimations;
+    const int bindingCount = animationContainer->m_numBindings;
+#endif
+
+    int recompressedCount = 0;
+
+    for (int i = 0; i < animationCount; i++)
+    {
+        Animation* animation = animationContainer->m_animations[i];
+
+        hkaAnimationBinding* animationBinding = nullptr;
+
+        for (int j = 0; j < bindingCount; j++)
+        {
+            if (animationContainer->m_bindings[j]->m_animation == animation)
+            {
+                animationBinding = animationContainer->m_bindings[j];
+                break;
+            }
+        }
+
+        SampledAnimation sampledAnimation;
+
+        if (!resampleAnimation(animation, animationBinding, sampledAnimation))
+            continue;
+
+        if (animation->m_numberOfFloatTracks > 0)
+            printf("WARNING: Float tracks are not supported, and were removed from animation %d.\n", i);
+
+        // Keep the original annotations, as they are not part of the sampled poses, unless the annotation mode leaves them out.
+        // Tracks stay paired with transform tracks by index, so with annotated tracks only, they are cut after the last annotated one.
+        hkArray<hkaAnnotationTrack> annotationTracks;
+
+#if _2010 || _2012
+        const int annotationTrackCount = std::min<int>(animation->m_annotationTracks.getSize(), animation->m_numberOfTransformTracks);
+#elif _550
+        const int annotationTrackCount = std::min<int>(animation->m_numAnnotationTracks, animation->m_numberOfTransformTracks);
+#endif
+
+        int keptTrackCount = settings.annotationMode == ANNOTATIONS_ALL ? annotationTrackCount : 0;
+
+        if (settings.annotationMode == ANNOTATIONS_ANNOTATED)
+        {
+            for (int j = 0; j < annotationTrackCount; j++)
+            {
+#if _2010 || _2012
+                if (animation->m_annotationTracks[j].m_annotations.getSize() > 0)
+#elif _550
+                if (getElement(animation->m_annotationTracks[j]).m_numAnnotations > 0)
+#endif
+                    keptTrackCount = j + 1;
+            }
+        }
+
+        for (int j = 0; j < keptTrackCount; j++)
+        {
+#if _2010 || _2012
+            annotationTracks.pushBack(animation->m_annotationTracks[j]);
+#elif _550
+            annotationTracks.pushBack(getElement(animation->m_annotationTracks[j]));
+#endif
+        }
+
+        const std::string name = "Animation " + std::to_string(i);
+
+        std::vector<SplineCompressedAnimation*> compressedAnimations;
+        const CompressionSettings fittedSettings = fitCompressionBudget(name.c_str(), { &sampledAnimation }, settings, compressedAnimations);
+
+        Animation* newAnimation = createAnimation(sampledAnimation, annotationTracks, fittedSettings, compressedAnimations.empty() ? nullptr : compressedAnimations[0]);
+
+        if (settings.budget > 0)
+            printCompressionError(name.c_str(), newAnimation, sampledAnimation);
+
+        animationContainer->m_animations[i] = newAnimation;
+
+        if (animationBinding != nullptr)
+        {
+            animationBinding->m_animation = newAnimation;
+
+#if _2010 || _2012
+            animationBinding->m_floatTrackToFloatSlotIndices.clear();
+#elif _550
+            animationBinding->m_numFloatTrackToFloatSlotIndices = 0;
+#endif
+        }
+
+        recompressedCount++;
+    }
+
+    return recompressedCount;
+}
+
+static const char* getAnnotationTrackName(const Animation* animation, int index)
+{
+#if _2010 || _2012
+    return animation->m_annotationTracks[index].m_trackName.cString();
+#elif _550
+    return getElement(animation->m_annotationTracks[index]).m_name;
+#endif
+}
+
+static int getAnnotationTrackCount(const Animation* animation)
+{
+#if _2010 || _2012
+    return animation->m_annotationTracks.getSize();
+#elif _550
+    return animation->m_numAnnotationTracks;
+#endif
+}
+
+static void getSampledAnnotations(const Animation* animation, int index, int boneIndex, std::vector<SampledAnnotation>& sampledAnnotations)
+{
+#if _2010 || _2012
+    const hkaAnnotationTrack& track = animation->m_annotationTracks[index];
+    const int annotationCount = track.m_annotations.getSize();
+#elif _550
+    const hkaAnnotationTrack& track = getElement(animation->m_annotationTracks[index]);
+    const int annotationCount = track.m_numAnnotations;
+#endif
+
+    for (int i = 0; i < annotationCount; i++)
+    {
+        SampledAnnotation annotation;
+        annotation.boneIndex = boneIndex;
+        annotation.time = (float)track.m_annotations[i].m_time;
+#if _2010 || _2012
+        annotation.text = track.m_annotations[i].m_text.cString();
+#elif _550
+        annotation.text = track.m_annotations[i].m_text;
+#endif
+
+        sampledAnnotations.push_back(annotation);
+    }
+}
+
+// Rebinds every animation in the container to a new skeleton, matching tracks to bones by name.
+// Animations whose tracks all map one-to-one to the new bones only get their binding rewritten.
+// Others are resampled. Animations with fewer tracks than the new skeleton has bones are treated as partial,
+// and keep only the tracks that still map to a bone. Full-body animations get one track per new bone,
+// where bones without a track hold their reference pose, or the identity for additive animations.
+// Returns the number of animations that were remapped.
+static int remapAnimations(hkaAnimationContainer* animationContainer, hkaSkeleton* skeleton, const char* originalSkeletonName, const CompressionSettings& settings)
+{
+    const int boneCount = getBoneCount(skeleton);
+
+    std::unordered_map<std::string, int> boneIndices;
+    boneIndices.reserve(boneCount);
+
+    for (int i = 0; i < boneCount; i++)
+        boneIndices.emplace(getBoneName(skeleton, i), i);
+
+#if _2010 || _2012
+    const int animationCount = animationContainer->m_animations.getSize();
+    const int bindingCount = animationContainer->m_bindings.getSize();
+#elif _550
+    const int animationCount = animationContainer->m_numAnimations;
+    const int bindingCount = animationContainer->m_numBindings;
+#endif
+
+    int remappedCount = 0;
+
+    for (int i = 0; i < animationCount; i++)
+    {
+        Animation* animation = animationContainer->m_animations[i];
+
+        int bindingIndex = -1;
+
+        for (int j = 0; j < bindingCount; j++)
+        {
+            if (animationContainer->m_bindings[j]->m_animation == animation)
+            {
+                bindingIndex = j;
+                break;
+            }
+        }
+
+        const int trackCount = animation->m_numberOfTransformTracks;
+
+        // Tracks are identified by their annotation track names, which match bone names.
+        if (bindingIndex < 0 || getAnnotationTrackCount(animation) != trackCount)
+        {
+            printf("WARNING: Animation %d has no binding or named tracks, and was left unchanged.\n", i);
+            continue;
+        }
+
+        std::vector<int> trackBoneIndices(trackCount, -1);
+        std::vector<int> boneTrackIndices(boneCount, -1);
+
+        bool oneToOne = true;
+        int outputTrackCount = trackCount;
+
+        for (int j = 0; j < trackCount; j++)
+        {
+            auto boneIndex = boneIndices.find(getAnnotationTrackName(animation, j));
+
+            if (boneIndex == boneIndices.end() || boneTrackIndices[boneIndex->second] >= 0)
+            {
+                oneToOne = false;
+                continue;
+            }
+
+            trackBoneIndices[j] = boneIndex->second;
+            boneTrackIndices[boneIndex->second] = j;
+        }
+
+        hkaAnimationBinding* animationBinding = animationContainer->m_bindings[bindingIndex];
+
+        if (oneToOne)
+        {
+            // Older bindings may leave the indices empty to map every track to the bone with the same index.
+            hkArray<hkInt16> transformTrackToBoneIndices;
+
+            for (int j = 0; j < trackCount; j++)
+                transformTrackToBoneIndices.pushBack((hkInt16)trackBoneIndices[j]);
+
+#if _2010 || _2012
+            animationBinding->m_transformTrackToBoneIndices = std::move(transformTrackToBoneIndices);
+            animationBinding->m_originalSkeletonName = originalSkeletonName;
+#elif _550
+            toPtrArray(transformTrackToBoneIndices, animationBinding->m_transformTrackToBoneIndices, animationBinding->m_numTransformTrackToBoneIndices);
+#endif
+        }
+        else
+        {
+            SampledAnimation sourceAnimation;
+
+            if (!resampleAnimation(animation, animationBinding, sourceAnimation))
+                continue;
+
+            SampledAnimation sampledAnimation;
+            sampledAnimation.duration = sourceAnimation.duration;
+            sampledAnimation.additive = sourceAnimation.additive;
+
+            if (trackCount < boneCount)
+            {
+                std::vector<int> keptBones;
+
+                for (int j = 0; j < boneCount; j++)
+                {
+                    if (boneTrackIndices[j] >= 0)
+                        keptBones.push_back(j);
+                }
+
+                if (keptBones.empty())
+                {
+                    printf("WARNING: Animation %d has no tracks matching the new skeleton, and was left unchanged.\n", i);
+                    continue;
+                }
+
+                outputTrackCount = (int)keptBones.size();
+                sampledAnimation.poses.resize(outputTrackCount, sourceAnimation.poses.frameCount);
+
+                for (int j = 0; j < outputTrackCount; j++)
+                {
+                    sampledAnimation.transformTrackToBoneIndices.pushBack((hkInt16)keptBones[j]);
+                    sampledAnimation.poses.copyTrack(j, sourceAnimation.poses, boneTrackIndices[keptBones[j]]);
+                }
+            }
+            else
+            {
+                hkQsTransform identity;
+                identity.setIdentity();
+
+                outputTrackCount = boneCount;
+                sampledAnimation.poses.resize(boneCount, sourceAnimation.poses.frameCount);
+
+                for (int j = 0; j < boneCount; j++)
+                {
+                    sampledAnimation.transformTrackToBoneIndices.pushBack((hkInt16)j);
+
+                    if (boneTrackIndices[j] >= 0)
+                        sampledAnimation.poses.copyTrack(j, sourceAnimation.poses, boneTrackIndices[j]);
+                    else
+                        sampledAnimation.poses.fillTrack(j, sampledAnimation.additive ? identity : skeleton->m_referencePose[j]);
+                }
+            }
+
+            sampledAnimation.poses.unrollRotations();
+
+            for (int j = 0; j < trackCount; j++)
+            {
+                if (trackBoneIndices[j] >= 0)
+                    getSampledAnnotations(animation, j, trackBoneIndices[j], sampledAnimation.annotations);
+            }
+
+            hkaAnimationBinding* newAnimationBinding = createAnimationAndBinding(sampledAnimation, skeleton, originalSkeletonName, settings);
+
+            animationContainer->m_animations[i] = newAnimationBinding->m_animation;
+            animationContainer->m_bindings[bindingIndex] = newAnimationBinding;
+        }
+
+        printf("Animation %d: %s (%d tracks -> %d tracks)\n", i, oneToOne ? "rebound" : "resampled", trackCount, outputTrackCount);
+
+        remappedCount++;
+    }
+
+    return remappedCount;
+}
+
+struct LodVariant
+{
+    std::string suffix;
+
+    // Frame rate, or 0 to keep the one from the options.
+    double fps = 0.0;
+
+    // Tolerances, or negative to keep the ones from the options.
+    float rotationTolerance = -1.0f;
+    float translationTolerance = -1.0f;
+    float scaleTolerance = -1.0f;
+
+    std::string boneMaskFileName;
+    std::vector<char> boneMask;
+};
+
+// Parses "suffix=_lod1,fps=30,rotation-tolerance=0.001,mask=upper_body.txt", where only the suffix is required.
+static bool parseLodVariant(const char* spec, LodVariant& variant)
+{
+    std::string fields = spec;
+
+    size_t begin = 0;
+    while (begin <= fields.size())
+    {
+        size_t end = fields.find(',', begin);
+        if (end == std::string::npos)
+            end = fields.size();
+
+        const std::string field = fields.substr(begin, end - begin);
+        const size_t separator = field.find('=');
+
+        if (separator == std::string::npos)
+            return false;
+
+        const std::string key = field.substr(0, separator);
+        const std::string value = field.substr(separator + 1);
+
+        if (key == "suffix")
+            variant.suffix = value;
+
+        else if (key == "fps")
+            variant.fps = atof(value.c_str());
+
+        else if (key == "rotation-tolerance")
+            variant.rotationTolerance = (float)atof(value.c_str());
+
+        else if (key == "translation-tolerance")
+            variant.translationTolerance = (float)atof(value.c_str());
+
+        else if (key == "scale-tolerance")
+            variant.scaleTolerance = (float)atof(value.c_str());
+
+        else if (key == "mask")
+            variant.boneMaskFileName = value;
+
+        else
+            return false;
+
+        begin = end + 1;
+    }
+
+    return !variant.suffix.empty() && variant.fps >= 0.0;
+}
+
+// Derives an animation at a lower or equal frame rate from poses sampled earlier, without going back to the source.
+static void deriveLodAnimation(const SampledAnimation& sourceAnimation, double sourceFps, double fps, const hkaSkeleton* skeleton,
+    const CompressionSettings& settings, SampledAnimation& sampledAnimation)
+{
+    const int frameCount = fps < sourceFps ? getFrameCount(sourceAnimation.duration, fps) : sourceAnimation.poses.frameCount;
+
+    sampledAnimation.duration = sourceAnimation.duration;
+    sampledAnimation.transformTrackToBoneIndices = sourceAnimation.transformTrackToBoneIndices;
+    sampledAnimation.annotations = sourceAnimation.annotations;
+    sampledAnimation.additive = sourceAnimation.additive;
+
+    if (frameCount < sourceAnimation.poses.frameCount)
+        sampledAnimation.poses.resample(sourceAnimation.poses, frameCount);
+    else
+        sampledAnimation.poses = sourceAnimation.poses;
+
+    maskTracks(sampledAnimation, skeleton, settings);
+}
+
+// Every line pairs a left and a right bone name, which may both contain a single * standing for the same text,
+// e.g. "L_* R_*". Returns the bone each bone is mirrored from, which is itself for unpaired bones.
+static bool loadBonePairs(const char* filePath, const hkaSkeleton* skeleton, std::vector<int>& bonePairs)
+{
+    FILE* file = fopen(filePath, "r");
+    if (file == nullptr)
+        return false;
+
+    const int boneCount = getBoneCount(skeleton);
+
+    std::unordered_map<std::string, int> boneIndices;
+
+    for (int i = 0; i < boneCount; i++)
+        boneIndices.emplace(getBoneName(skeleton, i), i);
+
+    bonePairs.resize(boneCount);
+
+    for (int i = 0; i < boneCount; i++)
+        bonePairs[i] = i;
+
+    char line[1024];
+    while (fgets(line, sizeof(line), file) != nullptr)
+    {
+        char left[256];
+        char right[256];
+
+        if (sscanf(line, " %255s %255s", left, right) != 2 || left[0] == '#')
+            continue;
+
+        const std::string leftPattern = left;
+        const std::string rightPattern = right;
+
+        const size_t leftWildcard = leftPattern.find('*');
+        const size_t rightWildcard = rightPattern.find('*');
+
+        for (int i = 0; i < boneCount; i++)
+        {
+            const std::string name = getBoneName(skeleton, i);
+            std::string pairName;
+
+            if (leftWildcard == std::string::npos || rightWildcard == std::string::npos)
+            {
+                if (name != leftPattern)
+                    continue;
+
+                pairName = rightPattern;
+            }
+            else
+            {
+                const size_t suffixSize = leftPattern.size() - leftWildcard - 1;
+
+                if (name.size() < leftPattern.size() - 1 || name.compare(0, leftWildcard, leftPattern, 0, leftWildcard) != 0 ||
+                    name.compare(name.size() - suffixSize, suffixSize, leftPattern, leftWildcard + 1, suffixSize) != 0)
+                    continue;
+
+                pairName = rightPattern.substr(0, rightWildcard) + name.substr(leftWildcard, name.size() - leftPattern.size() + 1) + rightPattern.substr(rightWildcard + 1);
+            }
+
+            auto pair = boneIndices.find(pairName);
+            if (pair == boneIndices.end())
+                continue;
+
+            bonePairs[i] = pair->second;
+            bonePairs[pair->second] = i;
+        }
+    }
+
+    fclose(file);
+    return true;
+}
+
+// Reflects a model space transform across the plane through the origin perpendicular to the axis.
+static hkQsTransform reflectTransform(const hkQsTransform& transform, int axis)
+{
+    hkQsTransform reflectedTransform = transform;
+
+    float translation[] = { (float)transform.m_translation(0), (float)transform.m_translation(1), (float)transform.m_translation(2) };
+    translation[axis] = -translation[axis];
+
+    float rotation[] = { -(float)transform.m_rotation.m_vec(0), -(float)transform.m_rotation.m_vec(1), -(float)transform.m_rotation.m_vec(2) };
+    rotation[axis] = -rotation[axis];
+
+    reflectedTransform.m_translation.set(translation[0], translation[1], translation[2], transform.m_translation(3));
+    reflectedTransform.m_rotation = hkQuaternion(rotation[0], rotation[1], rotation[2], transform.m_rotation.m_vec(3));
+
+    return reflectedTransform;
+}
+
+// Swaps paired bones and reflects the poses across the mirror axis in model space. Bone axes rarely mirror exactly,
+// so every bone gets corrected by the rotation that makes the mirrored reference pose match the reference pose.
+// Expects a track per bone, in bone order, as sampled from the FBX file.
+static bool mirrorAnimation(const SampledAnimation& sourceAnimation, const hkaSkeleton* skeleton, const std::vector<int>& bonePairs, int axis,
+    SampledAnimation& sampledAnimation)
+{
+    const int boneCount = getBoneCount(skeleton);
+    const PoseBuffer& sourcePoses = sourceAnimation.poses;
+
+    if (sourcePoses.trackCount != boneCount)
+        return false;
+
+    hkArray<hkQsTransform> referenceModelTransforms(boneCount);
+    hkaSkeletonUtils::transformLocalPoseToModelPose(boneCount, &skeleton->m_parentIndices[0], &skeleton->m_referencePose[0], &referenceModelTransforms[0]);
+
+    hkArray<hkQuaternion> corrections(boneCount);
+
+    for (int i = 0; i < boneCount; i++)
+    {
+        hkQuaternion inverseRotation;
+        inverseRotation.setInverse(reflectTransform(referenceModelTransforms[bonePairs[i]], axis).m_rotation);
+
+        corrections[i].setMul(inverseRotation, referenceModelTransforms[i].m_rotation);
+    }
+
+    sampledAnimation.duration = sourceAnimation.duration;
+    sampledAnimation.transformTrackToBoneIndices = sourceAnimation.transformTrackToBoneIndices;
+    sampledAnimation.annotations = sourceAnimation.annotations;
+    sampledAnimation.poses.resize(boneCount, sourcePoses.frameCount);
+
+    for (auto& annotation : sampledAnimation.annotations)
+        annotation.boneIndex = bonePairs[annotation.boneIndex];
+
+    parallelFor(sourcePoses.frameCount, [&](size_t frame)
+    {
+        hkArray<hkQsTransform> localTransforms(boneCount);
+        hkArray<hkQsTransform> modelTransforms(boneCount);
+        hkArray<hkQsTransform> mirroredModelTransforms(boneCount);
+
+        sourcePoses.getFrame((int)frame, &localTransforms[0]);
+        hkaSkeletonUtils::transformLocalPoseToModelPose(boneCount, &skeleton->m_parentIndices[0], &localTransforms[0], &modelTransforms[0]);
+
+        for (int i = 0; i < boneCount; i++)
+        {
+            const hkQsTransform reflectedTransform = reflectTransform(modelTransforms[bonePairs[i]], axis);
+
+            mirroredModelTransforms[i] = reflectedTransform;
+            mirroredModelTransforms[i].m_rotation.setMul(reflectedTransform.m_rotation, corrections[i]);
+        }
+
+        hkaSkeletonUtils::transformModelPoseToLocalPose(boneCount, &skeleton->m_parentIndices[0], &mirroredModelTransforms[0], &localTransforms[0]);
+        sampledAnimation.poses.setFrame((int)frame, &localTransforms[0]);
+    });
+
+    sampledAnimation.poses.unrollRotations();
+
+    return true;
+}
+
+// Turns poses into deltas against the base, frame by frame. The last base frame is used past its end,
+// so a single frame base acts as a pose. Without a base, deltas are against the reference pose.
+static void makeAdditiveAnimation(const SampledAnimation& sourceAnimation, const hkaSkeleton* skeleton, const SampledAnimation* baseAnimation,
+    SampledAnimation& sampledAnimation)
+{
+    const PoseBuffer& sourcePoses = sourceAnimation.poses;
+    const int trackCount = sourcePoses.trackCount;
+
+    sampledAnimation.duration = sourceAnimation.duration;
+    sampledAnimation.transformTrackToBoneIndices = sourceAnimation.transformTrackToBoneIndices;
+    sampledAnimation.annotations = sourceAnimation.annotations;
+    sampledAnimation.poses.resize(trackCount, sourcePoses.frameCount);
+    sampledAnimation.additive = true;
+
+    hkArray<hkQsTransform> referenceTransforms(trackCount);
+
+    for (int i = 0; i < trackCount; i++)
+        referenceTransforms[i] = skeleton->m_referencePose[sourceAnimation.transformTrackToBoneIndices[i]];
+
+    parallelFor(sourcePoses.frameCount, [&](size_t frame)
+    {
+        hkArray<hkQsTransform> transforms(trackCount);
+        hkArray<hkQsTransform> baseTransforms(trackCount);
+        hkArray<hkQsTransform> deltaTransforms(trackCount);
+
+        sourcePoses.getFrame((int)frame, &transforms[0]);
+
+        if (baseAnimation != nullptr)
+            baseAnimation->poses.getFrame(std::min<int>((int)frame, baseAnimation->poses.frameCount - 1), &baseTransforms[0]);
+        else
+            baseTransforms = referenceTransforms;
+
+        for (int i = 0; i < trackCount; i++)
+            deltaTransforms[i].setMulInverseMul(baseTransforms[i], transforms[i]);
+
+        sampledAnimation.poses.setFrame((int)frame, &deltaTransforms[0]);
+    });
+
+    sampledAnimation.poses.unrollRotations();
+}
+
+static std::string getFileNameWithoutExtension(std::string filePath)
+{
+    size_t index = filePath.find_last_of("\\/");
+    if (index != std::string::npos)
+        filePath = filePath.substr(index + 1);
+
+    index = filePath.find('.');
+    if (index != std::string::npos)
+        filePath = filePath.substr(0, index);
+
+    return filePath;
+}
+
+static std::string getDirectoryName(const std::string& filePath)
+{
+    return filePath.substr(0, filePath.find_last_of("\\/") + 1);
+}
+
+static bool checkIsAbsolutePath(const std::string& filePath)
+{
+    return (filePath.size() > 1 && filePath[1] == ':') || (!filePath.empty() && (filePath[0] == '\\' || filePath[0] == '/'));
+}
+
+// Reads one file path per line. Empty lines and lines starting with # are ignored,
+// and relative paths are resolved against the directory of the list file.
+static bool loadFileList(const char* filePath, std::vector<std::string>& filePaths)
+{
+    FILE* file = fopen(filePath, "r");
+    if (file == nullptr)
+        return false;
+
+    const std::string directoryName = getDirectoryName(filePath);
+
+    char line[1024];
+    while (fgets(line, sizeof(line), file) != nullptr)
+    {
+        std::string entry(line);
+
+        const size_t begin = entry.find_first_not_of(" \t\r\n");
+        if (begin == std::string::npos || entry[begin] == '#')
+            continue;
+
+        entry = entry.substr(begin, entry.find_last_not_of(" \t\r\n") - begin + 1);
+
+        if (entry.size() > 1 && entry.front() == '"' && entry.back() == '"')
+            entry = entry.substr(1, entry.size() - 2);
+
+        filePaths.push_back(checkIsAbsolutePath(entry) ? entry : directoryName + entry);
+    }
+
+    fclose(file);
+    return true;
+}
+
+static FbxScene* importScene(FbxManager* pManager, const char* filePath, bool importAnimation, bool fullImport)
+{
+    FbxIOSettings* lSettings = FbxIOSettings::Create(pManager, IOSROOT);
+
+    // Skeletons and animations only need the node hierarchy and its transforms,
+    // so skip everything else that bloats the import time of character FBX files.
+    // IMP_FBX_MODEL stays enabled since it covers every node, bones included.
+    if (!fullImport)
+    {
+        lSettings->SetBoolProp(IMP_FBX_MATERIAL, false);
+        lSettings->SetBoolProp(IMP_FBX_TEXTURE, false);
+        lSettings->SetBoolProp(IMP_FBX_LINK, false);
+        lSettings->SetBoolProp(IMP_FBX_SHAPE, false);
+        lSettings->SetBoolProp(IMP_FBX_GOBO, false);
+        lSettings->SetBoolProp(IMP_FBX_AUDIO, false);
+        lSettings->SetBoolProp(IMP_FBX_EXTRACT_EMBEDDED_DATA, false);
+        lSettings->SetBoolProp(IMP_FBX_ANIMATION, importAnimation);
+
+        if (!importAnimation)
+        {
+            lSettings->SetBoolProp(IMP_FBX_CHARACTER, false);
+            lSettings->SetBoolProp(IMP_FBX_CONSTRAINT, false);
+        }
+    }
+
+    pManager->SetIOSettings(lSettings);
+
+    FbxImporter* lImporter = FbxImporter::Create(pManager, "FbxImporter");
+    if (!lImporter->Initialize(filePath, -1, lSettings))
+    {
+        lImporter->Destroy();
+        return nullptr;
+    }
+
+    FbxScene* lScene = FbxScene::Create(pManager, "FbxScene");
+    const bool lResult = lImporter->Import(lScene);
+
+    lImporter->Destroy();
+
+    if (!lResult)
+    {
+        lScene->Destroy();
+        return nullptr;
+    }
+
+    return lScene;
+}
+
+// Samples the FBX file, or loads its poses from the cache directory if an earlier run already sampled it.
+// Returns an error message on failure.
+static const char* getSampledAnimation(FbxManager* pManager, const std::string& fbxFilePath, hkaSkeleton* skeleton, uint64_t skeletonHash,
+    const std::string& cacheDirectory, double fps, bool fullImport, SampledAnimation& sampledAnimation)
+{
+    std::string cacheFilePath;
+    PoseCacheKey cacheKey = {};
+
+    if (!cacheDirectory.empty())
+    {
+        cacheKey.skeletonHash = skeletonHash;
+        cacheKey.fps = fps;
+
+        if (computeFileHash(fbxFilePath.c_str(), cacheKey.fbxHash))
+        {
+            cacheFilePath = getPoseCacheFilePath(cacheDirectory, cacheKey);
+
+            if (loadPoseCache(cacheFilePath.c_str(), cacheKey, sampledAnimation) && sampledAnimation.poses.trackCount == getBoneCount(skeleton))
+                return nullptr;
+        }
+    }
+
+    FbxScene* lScene = importScene(pManager, fbxFilePath.c_str(), true, fullImport);
+    if (lScene == nullptr)
+        return "Failed to import FBX file.";
+
+    const bool result = sampleAnimation(lScene, skeleton, fps, sampledAnimation);
+
+    lScene->Destroy();
+
+    if (!result)
+        return "Failed to find animation data in FBX file.";
+
+    if (!cacheFilePath.empty())
+        savePoseCache(cacheFilePath.c_str(), cacheKey, sampledAnimation);
+
+    return nullptr;
+}
+
+struct PipelineClip
+{
+    size_t index;
+    double seconds;
+    SampledAnimation sampledAnimation;
+};
+
+struct CompressedClip
+{
+    size_t index;
+    double seconds;
+    hkaAnimationBinding* animationBinding;
+};
+
+// Clips whose poses round to the same values at the compression tolerances get the same key,
+// made of their bound bones, annotations and quantized poses.
+static void getClipKey(const SampledAnimation& sampledAnimation, const CompressionSettings& settings, std::vector<int>& key)
+{
+    const int trackCount = sampledAnimation.transformTrackToBoneIndices.getSize();
+
+    key.clear();
+    key.push_back(trackCount);
+
+    for (int i = 0; i < trackCount; i++)
+        key.push_back(sampledAnimation.transformTrackToBoneIndices[i]);
+
+    key.push_back((int)sampledAnimation.annotations.size());
+
+    for (auto& annotation : sampledAnimation.annotations)
+    {
+        int time;
+        memcpy(&time, &annotation.time, sizeof(time));
+
+        key.push_back(annotation.boneIndex);
+        key.push_back(time);
+        key.push_back((int)annotation.text.size());
+        key.insert(key.end(), annotation.text.begin(), annotation.text.end());
+    }
+
+    if (!settings.compress)
+    {
+        sampledAnimation.poses.quantize(0.0f, 0.0f, 0.0f, key);
+        return;
+    }
+
+    const CompressionSettings tolerances = scaleTolerances(settings, 1.0f);
+    sampledAnimation.poses.quantize(tolerances.rotationTolerance, tolerances.translationTolerance, tolerances.scaleTolerance, key);
+}
+
+static double getElapsedSeconds(std::chrono::steady_clock::time_point begin)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+// Exports clips through import and sampling, compression and output stages connected by bounded queues,
+// so clips get imported while earlier ones compress and get written, without holding more than a few in memory.
+// Every clip being imported gets its own FBX manager. output is called from a single thread, in completion order.
+// Clips are imported longest first, as estimated with the history file, which then gets updated with the measured times.
+// With aliases, clips with the same key as an earlier one skip compression and are output with its binding instead,
+// and aliases receives the index of the clip each one duplicates, or SIZE_MAX.
+// Bindings are released once output unless keepBindings is set, in which case output takes them over.
+// With aliases, any later clip may duplicate one output earlier, so bindings are only released once every clip is output.
+// Returns the number of clips that failed to import.
+static size_t runClipPipeline(const std::vector<std::string>& clipFilePaths, hkaSkeleton* skeleton, uint64_t skeletonHash, const char* originalSkeletonName,
+    const std::string& cacheDirectory, const std::string& historyFilePath, double fps, bool fullImport, const CompressionSettings& settings,
+    const std::function<void(size_t, hkaAnimationBinding*)>& output, bool keepBindings, std::vector<size_t>* aliases = nullptr)
+{
+    if (clipFilePaths.empty())
+        return 0;
+
+    if (aliases != nullptr)
+        aliases->assign(clipFilePaths.size(), SIZE_MAX);
+
+    // Keys are hashed to find candidates quickly, and kept for every distinct clip to rule out hash collisions.
+    std::mutex fingerprintMutex;
+    std::unordered_multimap<uint64_t, size_t> fingerprints;
+    std::vector<std::vector<int>> clipKeys(aliases != nullptr ? clipFilePaths.size() : 0);
+
+    BatchHistory history;
+
+    if (!historyFilePath.empty())
+        loadBatchHistory(historyFilePath.c_str(), history);
+
+    std::vector<double> units;
+    const std::vector<size_t> order = scheduleClips(clipFilePaths, getBoneCount(skeleton), fps, history, units);
+
+    const size_t importerCount = std::min<size_t>(clipFilePaths.size(), 2);
+    const size_t compressorCount = std::min<size_t>(clipFilePaths.size(), std::max<size_t>(1, getWorkerCount() / 2));
+
+    BoundedQueue<std::unique_ptr<PipelineClip>> sampledClips(compressorCount * 2, importerCount);
+    BoundedQueue<CompressedClip> compressedClips(2, compressorCount);
+
+    std::atomic<size_t> nextClip(0);
+    std::atomic<size_t> failedCount(0);
+
+    std::vector<std::function<void()>> stages;
+
+    for (size_t i = 0; i < importerCount; i++)
+    {
+        stages.push_back([&]()
+        {
+            size_t next;
+            while ((next = nextClip++) < clipFilePaths.size())
+            {
+                const size_t index = order[next];
+                const auto begin = std::chrono::steady_clock::now();
+
+                std::unique_ptr<PipelineClip> clip(new PipelineClip());
+                clip->index = index;
+
+                FbxManager* lManager = FbxManager::Create();
+                const char* error = getSampledAnimation(lManager, clipFilePaths[index], skeleton, skeletonHash, cacheDirectory, fps, fullImport, clip->sampledAnimation);
+                lManager->Destroy();
+
+                clip->seconds = getElapsedSeconds(begin);
+
+                if (error != nullptr)
+                {
+                    printf("ERROR: %s: %s\n", clipFilePaths[index].c_str(), error);
+                    failedCount++;
+                    continue;
+                }
+
+                maskTracks(clip->sampledAnimation, skeleton, settings);
+
+                sampledClips.push(std::move(clip));
+            }
+
+            sampledClips.finishProducer();
+        });
+    }
+
+    for (size_t i = 0; i < compressorCount; i++)
+    {
+        stages.push_back([&]()
+        {
+            std::unique_ptr<PipelineClip> clip;
+            while (sampledClips.pop(clip))
+            {
+                const auto begin = std::chrono::steady_clock::now();
+
+                if (aliases != nullptr)
+                {
+                    std::vector<int> key;
+                    getClipKey(clip->sampledAnimation, settings, key);
+
+                    const uint64_t fingerprint = computeHash(key.data(), key.size() * sizeof(int));
+                    size_t original = SIZE_MAX;
+
+                    std::unique_lock<std::mutex> lock(fingerprintMutex);
+
+                    const auto candidates = fingerprints.equal_range(fingerprint);
+
+                    for (auto candidate = candidates.first; candidate != candidates.second; ++candidate)
+                    {
+                        if (clipKeys[candidate->second] == key)
+                        {
+                            original = candidate->second;
+                            break;
+                        }
+                    }
+
+                    if (original == SIZE_MAX)
+                    {
+                        fingerprints.emplace(fingerprint, clip->index);
+                        clipKeys[clip->index] = std::move(key);
+                    }
+
+                    lock.unlock();
+
+                    if (original != SIZE_MAX)
+                    {
+                        (*aliases)[clip->index] = original;
+
+                        CompressedClip compressedClip = { clip->index, clip->seconds + getElapsedSeconds(begin), nullptr };
+                        compressedClips.push(std::move(compressedClip));
+                        continue;
+                    }
+                }
+
+                hkaAnimationBinding* animationBinding = createFittedAnimationAndBinding(getFileNameWithoutExtension(clipFilePaths[clip->index]).c_str(),
+                    clip->sampledAnimation, skeleton, originalSkeletonName, settings);
+
+                CompressedClip compressedClip = { clip->index, clip->seconds + getElapsedSeconds(begin), animationBinding };
+                compressedClips.push(std::move(compressedClip));
+                clip.reset();
+            }
+
+            compressedClips.finishProducer();
+        });
+    }
+
+    stages.push_back([&]()
+    {
+        // Aliases can arrive before the clip they duplicate is done compressing, in which case they wait for it.
+        std::unordered_map<size_t, hkaAnimationBinding*> outputBindings;
+        std::unordered_map<size_t, std::vector<CompressedClip>> pendingAliases;
+
+        std::function<void(const CompressedClip&)> outputClip = [&](const CompressedClip& clip)
+        {
+            const auto begin = std::chrono::steady_clock::now();
+
+            output(clip.index, clip.animationBinding);
+
+            ClipTiming timing = { clip.seconds + getElapsedSeconds(begin), units[clip.index], getFileSize(clipFilePaths[clip.index].c_str()) };
+            history[clipFilePaths[clip.index]] = timing;
+
+            if (aliases == nullptr)
+            {
+                if (!keepBindings)
+                    releaseAnimationBinding(clip.animationBinding);
+
+                return;
+            }
+
+            outputBindings[clip.index] = clip.animationBinding;
+
+            auto pending = pendingAliases.find(clip.index);
+            if (pending == pendingAliases.end())
+                return;
+
+            std::vector<CompressedClip> aliasClips = std::move(pending->second);
+            pendingAliases.erase(pending);
+
+            for (auto& aliasClip : aliasClips)
+            {
+                aliasClip.animationBinding = clip.animationBinding;
+                outputClip(aliasClip);
+            }
+        };
+
+        CompressedClip clip;
+        while (compressedClips.pop(clip))
+        {
+            if (clip.animationBinding == nullptr)
+            {
+                const size_t original = (*aliases)[clip.index];
+
+                auto outputBinding = outputBindings.find(original);
+                if (outputBinding == outputBindings.end())
+                {
+                    pendingAliases[original].push_back(clip);
+                    continue;
+                }
+
+                clip.animationBinding = outputBinding->second;
+            }
+
+            outputClip(clip);
+        }
+
+        if (keepBindings)
+            return;
+
+        // Aliases share the binding of the clip they duplicate, which is released once.
+        for (auto& outputBinding : outputBindings)
+        {
+            if ((*aliases)[outputBinding.first] == SIZE_MAX)
+                releaseAnimationBinding(outputBinding.second);
+        }
+    });
+
+    parallelInvoke(stages);
+
+    if (!historyFilePath.empty())
+        saveBatchHistory(historyFilePath.c_str(), history);
+
+    return failedCount;
+}
+
+// Writes one "alias original" line of clip names per duplicate clip. The clip listed first stands for each group of duplicates,
+// regardless of which one finished importing first.
+static bool saveAliasReport(const char* filePath, const std::vector<std::string>& clipFilePaths, const std::vector<size_t>& aliases)
+{
+    std::vector<size_t> canonical(clipFilePaths.size());
+
+    for (size_t i = 0; i < clipFilePaths.size(); i++)
+        canonical[i] = i;
+
+    for (size_t i = 0; i < clipFilePaths.size(); i++)
+    {
+        if (aliases[i] != SIZE_MAX)
+            canonical[aliases[i]] = std::min<size_t>(canonical[aliases[i]], i);
+    }
+
+    std::vector<std::pair<std::string, std::string>> lines;
+
+    for (size_t i = 0; i < clipFilePaths.size(); i++)
+    {
+        const size_t original = canonical[aliases[i] != SIZE_MAX ? aliases[i] : i];
+
+        if (original != i)
+            lines.emplace_back(getFileNameWithoutExtension(clipFilePaths[i]), getFileNameWithoutExtension(clipFilePaths[original]));
+    }
+
+    std::sort(lines.begin(), lines.end());
+
+    std::string text;
+    for (auto& line : lines)
+        text += line.first + " " + line.second + "\n";
+
+    printf("Found %d duplicate clips.\n", (int)lines.size());
+
+    return writeFileAtomic(filePath, text.data(), text.size(), false);
+}
+
+struct OutputTarget
+{
+    std::string name;
+    hkStructureLayout layout;
+    bool tagfile;
+};
+
+struct OutputSettings
+{
+    hkStructureLayout layout;
+    bool tagfile = false;
+
+    // When not empty, the container is saved once per target instead, to paths derived from the destination.
+    std::vector<OutputTarget> targets;
+
+    // Picks whichever of packfile and tagfile loads faster, measured on the output itself.
+    bool autoFormat = false;
+
+    // Writes both formats and reports their sizes, save times and load times.
+    bool compareFormats = false;
+
+    // Leaves files that already hold the same bytes untouched.
+    bool skipUnchanged = false;
+
+    // When set, files are added to the archive by their path relative to it instead of being written to disk.
+    ArchiveWriter* archive = nullptr;
+};
+
+static void setAnimationContainer(hkaAnimationContainer& animationContainer, hkArray<HK_REF_PTR(Animation)>& animations,
+    hkArray<HK_REF_PTR(hkaAnimationBinding)>& bindings, hkArray<HK_REF_PTR(hkaSkeleton)>& skeletons)
+{
+#if _2010 || _2012
+    animationContainer.m_animations = std::move(animations);
+    animationContainer.m_bindings = std::move(bindings);
+    animationContainer.m_skeletons = std::move(skeletons);
+#elif _550
+    toPtrArray(animations, animationContainer.m_animations, animationContainer.m_numAnimations);
+    toPtrArray(bindings, animationContainer.m_bindings, animationContainer.m_numBindings);
+    toPtrArray(skeletons, animationContainer.m_skeletons, animationContainer.m_numSkeletons);
+#endif
+}
+
+static void savePackfile(hkStreamWriter* stream, hkRootLevelContainer* levelContainer, const hkStructureLayout& layout)
+{
+    hkBinaryPackfileWriter* writer = new hkBinaryPackfileWriter();
+    writer->setContents(levelContainer, hkRootLevelContainerClass);
+
+    hkBinaryPackfileWriter::Options options = {};
+    options.m_layout = layout;
+
+    writer->save(stream, options);
+    writer->removeReference();
+}
+
+static void serializeRootLevelContainer(hkStreamWriter* stream, hkRootLevelContainer* levelContainer, const hkStructureLayout& layout, bool tagfile)
+{
+#if _2010 || _2012
+    if (tagfile)
+    {
+        hkSerializeUtil::saveTagfile(levelContainer, hkRootLevelContainerClass, stream);
+    }
+    else
+#endif
+    {
+        savePackfile(stream, levelContainer, layout);
+    }
+}
+
+static bool writeFile(const char* filePath, const hkArray<char>& data, const OutputSettings& settings)
+{
+    if (settings.archive != nullptr)
+    {
+        const std::string fileName = settings.archive->getEntryName(filePath);
+
+        if (settings.archive->add(fileName, data.begin(), data.getSize()))
+            return true;
+
+        if (settings.archive->checkHasEntry(fileName))
+            printf("ERROR: Multiple outputs are named %s in the archive\n", fileName.c_str());
+        else
+            printf("ERROR: Failed to add %s to the archive\n", fileName.c_str());
+
+        return false;
+    }
+
+    if (writeFileAtomic(filePath, data.begin(), data.getSize(), settings.skipUnchanged))
+        return true;
+
+    printf("ERROR: Failed to write %s\n", filePath);
+    return false;
+}
+
+static std::string insertExtension(const std::string& filePath, const char* extension)
+{
+    const size_t index = filePath.find_last_of('.');
+    if (index == std::string::npos || index < filePath.find_last_of("\\/") + 1)
+        return filePath + extension;
+
+    return filePath.substr(0, index) + extension + filePath.substr(index);
+}
+
+// Replaces {platform} in the pattern with the target name, or inserts the name before the extension if there is none.
+static std::string getTargetFilePath(const std::string& pattern, const std::string& targetName)
+{
+    const size_t index = pattern.find("{platform}");
+    if (index == std::string::npos)
+        return insertExtension(pattern, ("." + targetName).c_str());
+
+    return pattern.substr(0, index) + targetName + pattern.substr(index + 10);
+}
+
+static bool parseOutputTargets(const char* targetNames, std::vector<OutputTarget>& targets)
+{
+    std::string names = targetNames;
+    size_t begin = 0;
+
+    while (begin <= names.size())
+    {
+        size_t end = names.find(',', begin);
+        if (end == std::string::npos)
+            end = names.size();
+
+        OutputTarget target;
+        target.name = names.substr(begin, end - begin);
+        target.tagfile = false;
+
+        if (target.name == "win32")
+            target.layout = hkStructureLayout::MsvcWin32LayoutRules;
+
+        else if (target.name == "xbox360")
+            target.layout = hkStructureLayout::Xbox360LayoutRules;
+
+        else if (target.name == "ps3")
+            target.layout = hkStructureLayout::GccPs3LayoutRules;
+
+#ifdef _2012
+        else if (target.name == "wiiu")
+            target.layout = hkStructureLayout::GhsWiiULayoutRules;
+#endif
+
+#if _2010 || _2012
+        else if (target.name == "tagfile")
+        {
+            target.layout = hkStructureLayout::HostLayoutRules;
+            target.tagfile = true;
+        }
+#endif
+
+        else
+            return false;
+
+        targets.push_back(target);
+        begin = end + 1;
+    }
+
+    return true;
+}
+
+#if _2010 || _2012
+
+struct SerializationCost
+{
+    hkArray<char> data;
+    double saveTime = 0.0;
+    double loadTime = 0.0;
+    bool loaded = false;
+};
+
+static double getElapsedMilliseconds(std::chrono::steady_clock::time_point begin)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+}
+
+// A single load is easily skewed by page faults and other processes, so the fastest of several loads is used.
+static const int SERIALIZATION_LOAD_SAMPLES = 5;
+
+static void measureSerializationCost(hkRootLevelContainer* levelContainer, const hkStructureLayout& layout, bool tagfile, SerializationCost& cost)
+{
+    auto begin = std::chrono::steady_clock::now();
+    {
+        hkArrayStreamWriter writer(&cost.data, hkArrayStreamWriter::ARRAY_BORROW);
+        serializeRootLevelContainer(&writer, levelContainer, layout, tagfile);
+    }
+    cost.saveTime = getElapsedMilliseconds(begin);
+
+    // Packfiles can only be loaded in the host layout. Their load cost is dominated by
+    // pointer fixups, which does not depend on the layout, so the host layout stands in for the target.
+    hkArray<char> hostData;
+    const hkArray<char>* loadData = &cost.data;
+
+    if (!tagfile && memcmp(&layout.getRules(), &hkStructureLayout::HostLayoutRules, sizeof(hkStructureLayout::LayoutRules)) != 0)
+    {
+        hkArrayStreamWriter writer(&hostData, hkArrayStreamWriter::ARRAY_BORROW);
+        serializeRootLevelContainer(&writer, levelContainer, hkStructureLayout::HostLayoutRules, false);
+
+        loadData = &hostData;
+    }
+
+    for (int i = 0; i < SERIALIZATION_LOAD_SAMPLES; i++)
+    {
+        begin = std::chrono::steady_clock::now();
+
+        hkSerializeUtil::ErrorDetails errorDetails;
+        hkResource* resource = hkSerializeUtil::load(loadData->begin(), loadData->getSize(), &errorDetails);
+
+        const double loadTime = getElapsedMilliseconds(begin);
+
+        cost.loaded = resource != nullptr && errorDetails.id == hkSerializeUtil::ErrorDetails::ERRORID_NONE;
+
+        if (resource != nullptr)
+            resource->removeReference();
+
+        if (!cost.loaded)
+            break;
+
+        cost.loadTime = i == 0 ? loadTime : std::min(cost.loadTime, loadTime);
+    }
+}
+
+#endif
+
+// Returns false if any file failed to be written, which has been reported already.
+static bool saveRootLevelContainer(const char* dstFilePath, hkRootLevelContainer* levelContainer, const OutputSettings& settings)
+{
+#if _2010 || _2012
+    if (settings.compareFormats || settings.autoFormat)
+    {
+        SerializationCost packfileCost;
+        SerializationCost tagfileCost;
+
+        measureSerializationCost(levelContainer, settings.layout, false, packfileCost);
+        measureSerializationCost(levelContainer, settings.layout, true, tagfileCost);
+
+        if (settings.compareFormats)
+        {
+            const std::string tagfilePath = insertExtension(dstFilePath, ".tag");
+
+            const bool packfileWritten = writeFile(dstFilePath, packfileCost.data, settings);
+            const bool tagfileWritten = writeFile(tagfilePath.c_str(), tagfileCost.data, settings);
+
+            printf("%s\n", dstFilePath);
+            printf("  packfile: %10d bytes, save %8.3f ms, load %8.3f ms%s\n", packfileCost.data.getSize(), packfileCost.saveTime, packfileCost.loadTime, packfileCost.loaded ? "" : " (load failed)");
+            printf("  tagfile:  %10d bytes, save %8.3f ms, load %8.3f ms%s\n", tagfileCost.data.getSize(), tagfileCost.saveTime, tagfileCost.loadTime, tagfileCost.loaded ? "" : " (load failed)");
+            printf("  tagfile written to %s\n", tagfilePath.c_str());
+
+            return packfileWritten && tagfileWritten;
+        }
+
+        const bool tagfile = tagfileCost.loaded && (!packfileCost.loaded || tagfileCost.loadTime < packfileCost.loadTime);
+        return writeFile(dstFilePath, tagfile ? tagfileCost.data : packfileCost.data, settings);
+    }
+#endif
+
+    // Serializes into memory first, so the file is written with a single write and replaced atomically.
+    hkArray<char> data;
+    {
+        hkArrayStreamWriter writer(&data, hkArrayStreamWriter::ARRAY_BORROW);
+        serializeRootLevelContainer(&writer, levelContainer, settings.layout, settings.tagfile);
+    }
+
+    return writeFile(dstFilePath, data, settings);
+}
+
+static bool saveRootLevelContainer(const char* dstFilePath, hkArray<hkRootLevelContainer::NamedVariant>& namedVariants, const OutputSettings& settings)
+{
+    hkRootLevelContainer levelContainer;
+
+#if _2010 || _2012
+    levelContainer.m_namedVariants = std::move(namedVariants);
+#elif _550
+    toPtrArray(namedVariants, levelContainer.m_namedVariants, levelContainer.m_numNamedVariants);
+#endif
+
+    if (settings.targets.empty())
+        return saveRootLevelContainer(dstFilePath, &levelContainer, settings);
+
+    std::atomic<bool> saved(true);
+
+    // Serialization only reads the container, so every target can be written concurrently.
+    parallelFor(settings.targets.size(), [&](size_t i)
+    {
+        const OutputTarget& target = settings.targets[i];
+
+        OutputSettings targetSettings = settings;
+        targetSettings.layout = target.layout;
+        targetSettings.tagfile = target.tagfile;
+        targetSettings.targets.clear();
+
+        if (!saveRootLevelContainer(getTargetFilePath(dstFilePath, target.name).c_str(), &levelContainer, targetSettings))
+            saved = false;
+    });
+
+    return saved;
+}
+
+static bool saveAnimationContainer(const char* dstFilePath, hkaAnimationContainer* animationContainer, const char* variantName, const OutputSettings& settings)
+{
+    hkArray<hkRootLevelContainer::NamedVariant> namedVariants;
+    namedVariants.pushBack(hkRootLevelContainer::NamedVariant(variantName, animationContainer, &hkaAnimationContainerClass));
+
+    return saveRootLevelContainer(dstFilePath, namedVariants, settings);
+}
+
+// Saves the objects in a container of their own, which holds them only while saving.
+static bool saveAnimationContainer(const char* dstFilePath, hkArray<HK_REF_PTR(Animation)>& animations, hkArray<HK_REF_PTR(hkaAnimationBinding)>& bindings,
+    hkArray<HK_REF_PTR(hkaSkeleton)>& skeletons, const char* variantName, const OutputSettings& settings)
+{
+#ifdef _550
+    hkaAnimationContainer animationContainer {};
+#else
+    hkaAnimationContainer animationContainer;
+#endif
+
+    setAnimationContainer(animationContainer, animations, bindings, skeletons);
+    const bool saved = saveAnimationContainer(dstFilePath, &animationContainer, variantName, settings);
+
+#ifdef _550
+    delete[] animationContainer.m_animations;
+    delete[] animationContainer.m_bindings;
+    delete[] animationContainer.m_skeletons;
+#endif
+
+    return saved;
+}
+
+static bool saveAnimationBinding(const char* dstFilePath, hkaAnimationBinding* animationBinding, const OutputSettings& settings)
+{
+    hkArray<HK_REF_PTR(Animation)> animations;
+    hkArray<HK_REF_PTR(hkaAnimationBinding)> bindings;
+    hkArray<HK_REF_PTR(hkaSkeleton)> skeletons;
+
+    animations.pushBack(animationBinding->m_animation);
+    bindings.pushBack(animationBinding);
+
+    return saveAnimationContainer(dstFilePath, animations, bindings, skeletons, "Merged Animation Container", settings);
+}
+
+static bool saveSkeleton(const char* dstFilePath, hkaSkeleton* skeleton, const OutputSettings& settings)
+{
+    hkArray<HK_REF_PTR(Animation)> animations;
+    hkArray<HK_REF_PTR(hkaAnimationBinding)> bindings;
+    hkArray<HK_REF_PTR(hkaSkeleton)> skeletons;
+
+    skeletons.pushBack(skeleton);
+
+    return saveAnimationContainer(dstFilePath, animations, bindings, skeletons, "Animation Container", settings);
+}
+
+// Inserts the suffix before the first extension of the file name, e.g. idle.anm.hkx becomes idle_lod1.anm.hkx.
+static std::string insertFileNameSuffix(const std::string& filePath, const std::string& suffix)
+{
+    const size_t index = filePath.find('.', filePath.find_last_of("\\/") + 1);
+    if (index == std::string::npos)
+        return filePath + suffix;
+
+    return filePath.substr(0, index) + suffix + filePath.substr(index);
+}
+
+static std::string getValidFileName(std::string fileName)
+{
+    for (auto& c : fileName)
+    {
+        if (strchr("<>:\"/\\|?*", c) != nullptr)
+            c = '_';
+    }
+
+    return fileName;
+}
+
+// Windows file names are case insensitive, so names that only differ in case collide as well.
+static std::string getUniqueFileName(const std::string& fileName, std::unordered_set<std::string>& usedFileNames)
+{
+    std::string uniqueFileName = fileName;
+
+    for (int index = 1; ; index++)
+    {
+        std::string key = uniqueFileName;
+        std::transform(key.begin(), key.end(), key.begin(), [](char c) { return (char)tolower((unsigned char)c); });
+
+        if (usedFileNames.insert(key).second)
+            return uniqueFileName;
+
+        uniqueFileName = fileName + "_" + std::to_string(index);
+    }
+}
+
+// Moves the archive into place once every output has been added. Returns the exit code of main,
+// which is an error if any output failed to be saved, in which case the archive is discarded.
+static int closeArchive(ArchiveWriter& archive, bool saved)
+{
+    if (!saved)
+        FATAL_ERROR("Failed to save some of the output files.");
+
+    if (archive.checkIsOpen() && !archive.close())
+        FATAL_ERROR("Failed to write archive file.");
+
+    return 0;
+}
+
+int main(int argc, const char** argv)
+{
+    std::string srcFileName;
+    std::string dstFileName;
+    std::string sklFileName;
+    std::string packFileName;
+    std::string batchFileName;
+    std::string historyFileName;
+    std::string cacheDirectory;
+    std::string clipsFileName;
+    std::string archiveFileName;
+    std::string probePath;
+    std::string dedupFileName;
+    std::string boneMaskFileName;
+    std::vector<char> boneMask;
+    std::vector<LodVariant> lodVariants;
+    std::string bonePairsFileName;
+    int mirrorAxis = 0;
+    bool additive = false;
+    std::string additiveBaseFileName;
+    bool archiveCompress = false;
+    bool takeClips = false;
+
+    OutputSettings outputSettings;
+    outputSettings.layout =
+#ifdef _550
+        hkStructureLayout::Xbox360LayoutRules;
+#else
+        hkStructureLayout::MsvcWin32LayoutRules;
+#endif
+
+    CompressionSettings compressionSettings;
+    bool recompress = false;
+    bool remap = false;
+    bool fullImport = false;
+    bool allSkeletons = false;
+    bool splitSkeletons = false;
+    bool testCompression = false;
+    double fps = 60.0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-s") == 0 || 
+            strcmp(argv[i], "--skl") == 0)
+        {
+            if (i < argc - 1)
+                sklFileName = argv[++i];
+        }
+
+        else if (strcmp(argv[i], "--pack") == 0)
+        {
+            if (i < argc - 1)
+                packFileName = argv[++i];
+        }
+
+        else if (strcmp(argv[i], "--batch") == 0)
+        {
+            if (i < argc - 1)
+                batchFileName = argv[++i];
+        }
+
+        else if (strcmp(argv[i], "--history") == 0)
+        {
+            if (i < argc - 1)
+                historyFileName = argv[++i];
+        }
+
+        else if (strcmp(argv[i], "--probe") == 0)
+        {
+            if (i < argc - 1)
+                probePath = argv[++i];
+        }
+
+        else if (strcmp(argv[i], "--bone-mask") == 0)
+        {
+            if (i < argc - 1)
+                boneMaskFileName = argv[++i];
+        }
+
+        else if (strcmp(argv[i], "--lod") == 0)
+        {
+            if (i < argc - 1)
+            {
+                lodVariants.emplace_back();
+
+                if (!parseLodVariant(argv[++i], lodVariants.back()))
+                    FATAL_ERROR("Invalid LOD variant.");
+            }
+        }
+
+        else if (strcmp(argv[i], "--mirror") == 0)
+        {
+            if (i < argc - 1)
+                bonePairsFileName = argv[++i];
+        }
+
+        else if (strncmp(argv[i], "--mirror-axis=", 14) == 0)
+        {
+            const char* axis = argv[i] + 14;
+
+            if (strlen(axis) != 1 || tolower(axis[0]) < 'x' || tolower(axis[0]) > 'z')
+                FATAL_ERROR("Unknown mirror axis.");
+
+            mirrorAxis = tolower(axis[0]) - 'x';
+        }
+
+        else if (strcmp(argv[i], "--additive") == 0)
+        {
+            additive = true;
+        }
+
+        else if (strcmp(argv[i], "--additive-base") == 0)
+        {
+            if (i < argc - 1)
+            {
+                additive = true;
+                additiveBaseFileName = argv[++i];
+            }
+        }
+
+        else if (strcmp(argv[i], "--drop-static-tracks") == 0)
+        {
+            compressionSettings.dropStaticTracks = true;
+        }
+
+        else if (strncmp(argv[i], "--annotations=", 14) == 0)
+        {
+            const char* annotationMode = argv[i] + 14;
+
+            if (strcmp(annotationMode, "none") == 0)
+                compressionSettings.annotationMode = ANNOTATIONS_NONE;
+
+            else if (strcmp(annotationMode, "annotated") == 0)
+                compressionSettings.annotationMode = ANNOTATIONS_ANNOTATED;
+
+            else if (strcmp(annotationMode, "all") == 0)
+                compressionSettings.annotationMode = ANNOTATIONS_ALL;
+
+            else
+                FATAL_ERROR("Unknown annotation mode.");
+        }
+
+        else if (strcmp(argv[i], "--dedup") == 0)
+        {
+            if (i < argc - 1)
+                dedupFileName = argv[++i];
+        }
+
+        else if (strcmp(argv[i], "--clips") == 0)
+        {
+            if (i < argc - 1)
+                clipsFileName = argv[++i];
+        }
+
+        else if (strcmp(argv[i], "--clips-from-takes") == 0)
+        {
+            takeClips = true;
+        }
+
+        else if (strcmp(argv[i], "--cache") == 0)
+        {
+            if (i < argc - 1)
+                cacheDirectory = argv[++i];
+        }
+
+        else if (strcmp(argv[i], "-u") == 0 ||
+            strcmp(argv[i], "--uncompressed") == 0)
+        {
+            compressionSettings.compress = false;
+        }
+
+        else if (strcmp(argv[i], "-r") == 0 ||
+            strcmp(argv[i], "--recompress") == 0)
+        {
+            recompress = true;
+        }
+
+        else if (strcmp(argv[i], "--remap") == 0)
+        {
+            remap = true;
+        }
+
+        else if (strcmp(argv[i], "--parallel-compression") == 0)
+        {
+            compressionSettings.blockParallel = true;
+        }
+
+        else if (strcmp(argv[i], "--verify-compression") == 0)
+        {
+            compressionSettings.blockParallel = true;
+            compressionSettings.verify = true;
+        }
+
+#if _2010 || _2012
+        else if (strcmp(argv[i], "--test-compression") == 0)
+        {
+            testCompression = true;
+        }
+#endif
+
+        else if (strcmp(argv[i], "--budget") == 0)
+        {
+            if (i < argc - 1)
+                compressionSettings.budget = atoi(argv[++i]);
+        }
+
+        else if (strcmp(argv[i], "--rotation-tolerance") == 0)
+        {
+            if (i < argc - 1)
+                compressionSettings.rotationTolerance = (float)atof(argv[++i]);
+        }
+
+        else if (strcmp(argv[i], "--translation-tolerance") == 0)
+        {
+            if (i < argc - 1)
+                compressionSettings.translationTolerance = (float)atof(argv[++i]);
+        }
+
+        else if (strcmp(argv[i], "--scale-tolerance") == 0)
+        {
+            if (i < argc - 1)
+                compressionSettings.scaleTolerance = (float)atof(argv[++i]);
+        }
+
+        else if (strcmp(argv[i], "-f") == 0 ||
+            strcmp(argv[i], "--fps") == 0)
+        {
+            fps = atof(argv[++i]);
+        }
+
+        else if (strcmp(argv[i], "--full-import") == 0)
+        {
+            fullImport = true;
+        }
+
+        else if (strcmp(argv[i], "-a") == 0 ||
+            strcmp(argv[i], "--all-skeletons") == 0)
+        {
+            allSkeletons = true;
+        }
+
+        else if (strcmp(argv[i], "--split") == 0)
+        {
+            allSkeletons = true;
+            splitSkeletons = true;
+        }
+
+#ifdef _550
+        else if (strcmp(argv[i], "-w") == 0 ||
+            strcmp(argv[i], "--windows") == 0)
+        {
+            outputSettings.layout = hkStructureLayout::MsvcWin32LayoutRules;
+        }
+#endif
+
+        else if (strcmp(argv[i], "-x") == 0 ||
+            strcmp(argv[i], "--xbox360") == 0)
+        {
+            outputSettings.layout = hkStructureLayout::Xbox360LayoutRules;
+        }     
+        
+        else if (strcmp(argv[i], "-p") == 0 ||
+            strcmp(argv[i], "--ps3") == 0)
+        {
+            outputSettings.layout = hkStructureLayout::GccPs3LayoutRules;
+        }
+
+#ifdef _2012
+        else if (strcmp(argv[i], "-w") == 0 ||
+            strcmp(argv[i], "--wiiu") == 0)
+        {
+            outputSettings.layout = hkStructureLayout::GhsWiiULayoutRules;
+        }
+#endif
+
+#if _2010 || _2012
+        else if (strcmp(argv[i], "-t") == 0 ||
+            strcmp(argv[i], "--tagfile") == 0)
+        {
+            outputSettings.tagfile = true;
+        }
+
+        else if (strncmp(argv[i], "--format=", 9) == 0)
+        {
+            const char* format = argv[i] + 9;
+
+            if (strcmp(format, "packfile") != 0 && strcmp(format, "tagfile") != 0 && strcmp(format, "auto") != 0)
+                FATAL_ERROR("Unknown output format.");
+
+            outputSettings.tagfile = strcmp(format, "tagfile") == 0;
+            outputSettings.autoFormat = strcmp(format, "auto") == 0;
+        }
+
+        else if (strcmp(argv[i], "--compare-formats") == 0)
+        {
+            outputSettings.compareFormats = true;
+        }
+#endif
+
+        else if (strcmp(argv[i], "--skip-unchanged") == 0)
+        {
+            outputSettings.skipUnchanged = true;
+        }
+
+        else if (strcmp(argv[i], "--archive") == 0)
+        {
+            if (i < argc - 1)
+                archiveFileName = argv[++i];
+        }
+
+        else if (strcmp(argv[i], "--archive-compress") == 0)
+        {
+            archiveCompress = true;
+        }
+
+        else if (strncmp(argv[i], "--targets=", 10) == 0)
+        {
+            if (!parseOutputTargets(argv[i] + 10, outputSettings.targets))
+                FATAL_ERROR("Unknown output target.");
+        }
+
+        else if (srcFileName.empty())
+            srcFileName = argv[i];
+
+        else if (dstFileName.empty())
+            dstFileName = argv[i];
+    }
+
+    // Only reads file headers, so there's no need to initialize Havok or FBX. The inventory goes to the path given, or stdout.
+    if (!probePath.empty())
+    {
+        const std::vector<HkxProbeResult> results = probeHkxFiles(probePath);
+
+        if (!saveHkxInventory(srcFileName, results))
+            FATAL_ERROR("Failed to save inventory file.");
+
+        size_t failedCount = 0;
+        for (auto& result : results)
+        {
+            if (!result.error.empty())
+                failedCount++;
+        }
+
+        fprintf(stderr, "Probed %d files, %d failed.\n", (int)results.size(), (int)failedCount);
+        return failedCount > 0 ? 1 : 0;
     }
 
-    if (srcFileName.empty())
+    // When packing, sources come from the list file, so the only positional argument is the destination.
+    if ((!packFileName.empty() || !batchFileName.empty()) && dstFileName.empty())
+        std::swap(srcFileName, dstFileName);
+
+    if (srcFileName.empty() && packFileName.empty() && batchFileName.empty() && !testCompression)
     {
         printf("ERROR: Insufficient amount of arguments were given.\n\n");
         printf("Havok Animation Exporter\n");
-        printf(" Usage: [source] [destination] [options]\n\n");
+        printf(" Usage: [source] [destination] [options]\n");
+        printf("        --skl [skeleton] --pack [list] [destination] [options]\n");
+        printf("        --skl [skeleton] --batch [list] [destination directory] [options]\n");
+        printf("        --probe [file or directory] [inventory]\n\n");
         printf(" Options:\n");
         printf("  -s or --skl:          Path to skeleton HKX file when generating animation data.\n");
+        printf("  --pack:               Path to a text file listing FBX files to pack into a single animation HKX file.\n");
+        printf("  --batch:              Path to a text file listing FBX files to export into separate animation HKX files.\n");
+        printf("  --probe:              Path to a HKX file or directory to list version, layout, sections and contents of, without loading.\n");
+        printf("  --history:            Path to a file of clip export times, used to start the longest clips of a batch or pack first.\n");
+        printf("  --bone-mask:          Path to a text file of bone name patterns to keep tracks for. Other bones are left out of the binding.\n");
+        printf("  --lod:                LOD variant to save next to the animation, e.g. suffix=_lod1,fps=30,rotation-tolerance=0.001,mask=upper.txt.\n");
+        printf("  --mirror:             Path to a text file of \"left right\" bone name pairs, to save a mirrored copy of the animation as well.\n");
+        printf("  --mirror-axis=[x|y|z]: Axis to mirror across. x by default.\n");
+        printf("  --additive:           Save an additive copy of the animation as well, relative to the reference pose.\n");
+        printf("  --additive-base:      Path to an FBX file to make the additive copy relative to, frame by frame.\n");
+        printf("  --drop-static-tracks: Leave out tracks that hold the reference pose throughout the animation. In blends, those bones take other layers' poses.\n");
+        printf("  --annotations=[none|annotated|all]: Annotation tracks to save. all by default, one per bone.\n");
+        printf("  --dedup:              Path to write a report of duplicate clips in a batch or pack to. Duplicates reuse the first clip's output.\n");
+        printf("  --clips:              Path to a text file of \"name start end\" lines, to cut the source FBX file into separate animations.\n");
+        printf("  --clips-from-takes:   Export every take in the source FBX file as a separate animation.\n");
+        printf("  --cache:              Directory to cache sampled poses in, so later runs skip FBX import and sampling.\n");
         printf("  -u or --uncompressed: Whether animation data is going to be uncompressed.\n");
-        printf("  -f or --fps:          Frames per second when generating animation data. 60 by default.\n\n");
+        printf("  -r or --recompress:   Source is an animation HKX file to recompress, instead of an FBX file.\n");
+        printf("  --remap:              Source is an animation HKX file to rebind to the skeleton given with --skl.\n");
+        printf("  --rotation-tolerance, --translation-tolerance, --scale-tolerance: Spline compression tolerances.\n");
+        printf("  --budget:             Compressed size limit in bytes per animation, or for the whole pack. Tolerances are raised until it fits.\n");
+#if _2010 || _2012
+        printf("  --parallel-compression: Compress long animations in block-aligned parts concurrently, checked against serial compression.\n");
+        printf("  --verify-compression: Compress in parts, and check every animation against serial compression.\n");
+        printf("  --test-compression:   Check block-parallel compression of generated animations against serial compression.\n");
+#endif
+        printf("  -f or --fps:          Frames per second when generating animation data. 60 by default.\n");
+        printf("  --full-import:        Import meshes, materials and textures from the FBX file as well.\n");
+        printf("  -a or --all-skeletons: Export every skeleton in the FBX file into a single skeleton HKX file.\n");
+        printf("  --split:              Export every skeleton in the FBX file into separate files named after their root nodes.\n\n");
 #ifdef _550
         printf("  -w or --windows:      Convert for Windows.\n");
 #endif
@@ -499,8 +3236,14 @@ int main(int argc, const char** argv)
 #ifdef _2012
         printf("  -w or --wiiu:         Convert for Wii U.\n");
 #endif
+        printf("  --skip-unchanged:     Leave output files untouched if their contents would not change.\n");
+        printf("  --archive [file]:     Add every output file to a single indexed archive instead of writing it to disk.\n");
+        printf("  --archive-compress:   Compress archive entries that get smaller when compressed.\n");
+        printf("  --targets=[list]:     Comma-separated platforms to save the output for at once, e.g. xbox360,ps3.\n");
 #if _2010 || _2012
         printf("  -t or --tagfile:      Convert for any platform. Resulting file will be saved in tagfile format.\n");
+        printf("  --format=[packfile|tagfile|auto]: Output format. auto picks whichever format loads faster for the output.\n");
+        printf("  --compare-formats:    Save output in both formats and report their sizes, save times and load times.\n");
 #endif
         printf("\nIf no destination path is specified, it's going to be automatically assumed from input.\n");
         printf("If no skeleton path is specified, a skeleton HKX file is going to be created from input.\n");
@@ -516,14 +3259,48 @@ int main(int argc, const char** argv)
         return 0;
     }
 
+    // Variants are derived from the poses of a single conversion, which the other modes never sample in one piece.
+    if ((!lodVariants.empty() || !bonePairsFileName.empty() || additive) &&
+        (sklFileName.empty() || !packFileName.empty() || !batchFileName.empty() || !clipsFileName.empty() || takeClips || recompress || remap))
+    {
+        FATAL_ERROR("--lod, --mirror and --additive only apply to single animation conversions with --skl.");
+    }
+
+    // Skeletons are only exported when no skeleton file is given, and every other mode leaves them out.
+    if (allSkeletons && (!sklFileName.empty() || !packFileName.empty() || !batchFileName.empty() || !clipsFileName.empty() || takeClips || recompress || remap))
+        FATAL_ERROR("--all-skeletons and --split only apply to skeleton exports without --skl.");
+
+    // Batches are written to a directory, next to the list file unless specified.
+    std::string batchDirectoryName;
+
+    if (!batchFileName.empty())
+    {
+        batchDirectoryName = dstFileName.empty() ? getDirectoryName(batchFileName) : dstFileName;
+
+        if (!batchDirectoryName.empty() && batchDirectoryName.back() != '\\' && batchDirectoryName.back() != '/')
+            batchDirectoryName += '/';
+    }
+
     if (dstFileName.empty())
     {
-        const std::string directoryName = getDirectoryName(srcFileName);
-        const std::string fileName = getFileNameWithoutExtension(srcFileName) + (sklFileName.empty() ? ".skl.hkx" : ".anm.hkx");
+        const std::string& fileNameSource = packFileName.empty() ? srcFileName : packFileName;
+        const std::string directoryName = getDirectoryName(fileNameSource);
+        const std::string fileName = getFileNameWithoutExtension(fileNameSource) + (sklFileName.empty() && !recompress && !remap ? ".skl.hkx" : ".anm.hkx");
 
         dstFileName = directoryName.empty() ? fileName : directoryName + fileName;
     }
 
+    // Discarded if main returns without closing it, so a failed run leaves the previous archive in place.
+    ArchiveWriter archive;
+
+    if (!archiveFileName.empty())
+    {
+        if (!archive.open(archiveFileName.c_str(), archiveCompress))
+            FATAL_ERROR("Failed to create archive file.");
+
+        outputSettings.archive = &archive;
+    }
+
 #if _2010 || _2012
     hkMemoryRouter* memoryRouter = hkMemoryInitUtil::initDefault(hkMallocAllocator::m_defaultMallocAllocator, hkMemorySystem::FrameInfo(10 * 1024 * 1024));
     hkBaseSystem::init(memoryRouter, havokErrorReportFunction);
@@ -536,16 +3313,10 @@ int main(int argc, const char** argv)
     hkBaseSystem::init(memoryManager, threadMemory, havokErrorReportFunction);
 #endif
 
-    FbxManager* lManager = FbxManager::Create();
-
-    FbxImporter* lImporter = FbxImporter::Create(lManager, "FbxImporter");
-    if (!lImporter->Initialize(srcFileName.c_str()))
-        FATAL_ERROR("Failed to load FBX file.");
-
-    FbxScene* lScene = FbxScene::Create(lManager, "FbxScene");
-
-    if (!lImporter->Import(lScene))
-        FATAL_ERROR("Failed to import FBX file.");
+#if _2010 || _2012
+    if (testCompression)
+        return testBlockCompression() ? 0 : 1;
+#endif
 
 #ifdef _550
     hkaAnimationContainer animationContainer {};
@@ -553,10 +3324,301 @@ int main(int argc, const char** argv)
     hkaAnimationContainer animationContainer;
 #endif
 
+    if (remap)
+    {
+        if (sklFileName.empty())
+            FATAL_ERROR("Remapping animations requires a skeleton file.");
+
+        hkaSkeleton* skeleton = loadSkeleton(sklFileName.c_str());
+
+        if (skeleton == nullptr)
+            FATAL_ERROR("Failed to load skeleton file.");
+
+        hkaAnimationContainer* sourceContainer = loadAnimationContainer(srcFileName.c_str());
+
+        if (sourceContainer == nullptr)
+            FATAL_ERROR("Failed to load animation file.");
+
+        if (remapAnimations(sourceContainer, skeleton, getFileNameWithoutExtension(sklFileName).c_str(), compressionSettings) == 0)
+            FATAL_ERROR("Failed to find animation data in animation file.");
+
+        const bool saved = saveAnimationContainer(dstFileName.c_str(), sourceContainer, "Merged Animation Container", outputSettings);
+
+        return closeArchive(archive, saved);
+    }
+
+    if (recompress)
+    {
+        hkaAnimationContainer* sourceContainer = loadAnimationContainer(srcFileName.c_str());
+
+        if (sourceContainer == nullptr)
+            FATAL_ERROR("Failed to load animation file.");
+
+        if (recompressAnimations(sourceContainer, compressionSettings) == 0)
+            FATAL_ERROR("Failed to find animation data in animation file.");
+
+        const bool saved = saveAnimationContainer(dstFileName.c_str(), sourceContainer, "Merged Animation Container", outputSettings);
+
+        return closeArchive(archive, saved);
+    }
+
+    if (!batchFileName.empty())
+    {
+        if (sklFileName.empty())
+            FATAL_ERROR("Exporting a batch requires a skeleton file.");
+
+        std::vector<std::string> clipFilePaths;
+
+        if (!loadFileList(batchFileName.c_str(), clipFilePaths) || clipFilePaths.empty())
+            FATAL_ERROR("Failed to load animation list file.");
+
+        // Every clip is saved to the batch directory under its own name, so names have to be unique, also when ignoring case.
+        std::unordered_set<std::string> usedFileNames;
+
+        for (auto& clipFilePath : clipFilePaths)
+        {
+            const std::string fileName = getFileNameWithoutExtension(clipFilePath);
+
+            if (getUniqueFileName(fileName, usedFileNames) != fileName)
+                FATAL_ERROR(("Multiple animations are named \"" + fileName + "\".").c_str());
+        }
+
+        hkaSkeleton* skeleton = loadSkeleton(sklFileName.c_str());
+
+        if (skeleton == nullptr)
+            FATAL_ERROR("Failed to load skeleton file.");
+
+        if (!applyBoneMask(boneMaskFileName, skeleton, boneMask, compressionSettings))
+            FATAL_ERROR("Failed to load bone mask file.");
+
+        uint64_t skeletonHash = 0;
+        computeFileHash(sklFileName.c_str(), skeletonHash);
+
+        std::vector<size_t> aliases;
+        bool saved = true;
+
+        const size_t failedCount = runClipPipeline(clipFilePaths, skeleton, skeletonHash, getFileNameWithoutExtension(sklFileName).c_str(),
+            cacheDirectory, historyFileName, fps, fullImport, compressionSettings, [&](size_t i, hkaAnimationBinding* animationBinding)
+        {
+            if (!saveAnimationBinding((batchDirectoryName + getFileNameWithoutExtension(clipFilePaths[i]) + ".anm.hkx").c_str(), animationBinding, outputSettings))
+                saved = false;
+        }, false, dedupFileName.empty() ? nullptr : &aliases);
+
+        if (!dedupFileName.empty() && !saveAliasReport(dedupFileName.c_str(), clipFilePaths, aliases))
+        {
+            printf("ERROR: Failed to write %s\n", dedupFileName.c_str());
+            saved = false;
+        }
+
+        if (failedCount > 0)
+            FATAL_ERROR("Failed to export some of the animations.");
+
+        return closeArchive(archive, saved);
+    }
+
+    FbxManager* lManager = FbxManager::Create();
+
+    if (!packFileName.empty())
+    {
+        if (sklFileName.empty())
+            FATAL_ERROR("Packing animations requires a skeleton file.");
+
+        std::vector<std::string> clipFilePaths;
+
+        if (!loadFileList(packFileName.c_str(), clipFilePaths) || clipFilePaths.empty())
+            FATAL_ERROR("Failed to load animation list file.");
+
+        hkaSkeleton* skeleton = loadSkeleton(sklFileName.c_str());
+
+        if (skeleton == nullptr)
+            FATAL_ERROR("Failed to load skeleton file.");
+
+        if (!applyBoneMask(boneMaskFileName, skeleton, boneMask, compressionSettings))
+            FATAL_ERROR("Failed to load bone mask file.");
+
+        // Clips are sorted by name, so the runtime can binary search the name index.
+        std::sort(clipFilePaths.begin(), clipFilePaths.end(), [](const std::string& lhs, const std::string& rhs)
+        {
+            return getFileNameWithoutExtension(lhs) < getFileNameWithoutExtension(rhs);
+        });
+
+        std::vector<std::string> clipNames;
+
+        for (auto& clipFilePath : clipFilePaths)
+        {
+            clipNames.push_back(getFileNameWithoutExtension(clipFilePath));
+
+            if (clipNames.size() > 1 && clipNames[clipNames.size() - 2] == clipNames.back())
+                FATAL_ERROR(("Multiple animations are named \"" + clipNames.back() + "\".").c_str());
+        }
+
+        uint64_t skeletonHash = 0;
+        computeFileHash(sklFileName.c_str(), skeletonHash);
+
+        const std::string originalSkeletonName = getFileNameWithoutExtension(sklFileName);
+
+        hkArray<HK_REF_PTR(Animation)> animations;
+        hkArray<HK_REF_PTR(hkaAnimationBinding)> bindings;
+        hkArray<HK_REF_PTR(hkaSkeleton)> skeletons;
+
+        // The first variant holds every clip. The rest form the name index,
+        // one variant per clip pointing at its binding, in the same order as the container unless clips are deduplicated.
+        hkArray<hkRootLevelContainer::NamedVariant> namedVariants;
+        namedVariants.pushBack(hkRootLevelContainer::NamedVariant("Merged Animation Container", &animationContainer, &hkaAnimationContainerClass));
+
+        std::vector<hkaAnimationBinding*> clipBindings(clipFilePaths.size());
+        bool saved = true;
+
+        if (compressionSettings.budget > 0)
+        {
+            std::vector<SampledAnimation> sampledAnimations(clipFilePaths.size());
+            std::vector<const SampledAnimation*> sampledAnimationPointers;
+
+            for (size_t i = 0; i < clipFilePaths.size(); i++)
+            {
+                const char* error = getSampledAnimation(lManager, clipFilePaths[i], skeleton, skeletonHash, cacheDirectory, fps, fullImport, sampledAnimations[i]);
+                if (error != nullptr)
+                    FATAL_ERROR((clipFilePaths[i] + ": " + error).c_str());
+
+                maskTracks(sampledAnimations[i], skeleton, compressionSettings);
+
+                sampledAnimationPointers.push_back(&sampledAnimations[i]);
+            }
+
+            // The budget applies to the pack as a whole, so every clip has to be sampled before any gets compressed.
+            std::vector<SplineCompressedAnimation*> compressedAnimations;
+            const CompressionSettings packCompressionSettings = fitCompressionBudget(getFileNameWithoutExtension(packFileName).c_str(),
+                sampledAnimationPointers, compressionSettings, compressedAnimations);
+
+            for (size_t i = 0; i < clipFilePaths.size(); i++)
+            {
+                clipBindings[i] = createAnimationAndBinding(sampledAnimations[i], skeleton, originalSkeletonName.c_str(), packCompressionSettings,
+                    compressedAnimations.empty() ? nullptr : compressedAnimations[i]);
+                printCompressionError(clipNames[i].c_str(), clipBindings[i]->m_animation, sampledAnimations[i]);
+            }
+        }
+        else
+        {
+            std::vector<size_t> aliases;
+
+            const size_t failedCount = runClipPipeline(clipFilePaths, skeleton, skeletonHash, originalSkeletonName.c_str(),
+                cacheDirectory, historyFileName, fps, fullImport, compressionSettings, [&](size_t i, hkaAnimationBinding* animationBinding)
+            {
+                clipBindings[i] = animationBinding;
+            }, true, dedupFileName.empty() ? nullptr : &aliases);
+
+            if (!dedupFileName.empty() && !saveAliasReport(dedupFileName.c_str(), clipFilePaths, aliases))
+            {
+                printf("ERROR: Failed to write %s\n", dedupFileName.c_str());
+                saved = false;
+            }
+
+            if (failedCount > 0)
+                FATAL_ERROR("Failed to export some of the animations.");
+        }
+
+        // Duplicate clips share a binding, which is stored once and named once per clip.
+        std::unordered_set<hkaAnimationBinding*> storedBindings;
+
+        for (size_t i = 0; i < clipFilePaths.size(); i++)
+        {
+            if (storedBindings.insert(clipBindings[i]).second)
+            {
+                animations.pushBack(clipBindings[i]->m_animation);
+                bindings.pushBack(clipBindings[i]);
+            }
+
+            namedVariants.pushBack(hkRootLevelContainer::NamedVariant(clipNames[i].c_str(), clipBindings[i], &hkaAnimationBindingClass));
+        }
+
+        setAnimationContainer(animationContainer, animations, bindings, skeletons);
+
+        if (!saveRootLevelContainer(dstFileName.c_str(), namedVariants, outputSettings))
+            saved = false;
+
+        return closeArchive(archive, saved);
+    }
+
+    if (!clipsFileName.empty() || takeClips)
+    {
+        if (sklFileName.empty())
+            FATAL_ERROR("Extracting clips requires a skeleton file.");
+
+        hkaSkeleton* skeleton = loadSkeleton(sklFileName.c_str());
+
+        if (skeleton == nullptr)
+            FATAL_ERROR("Failed to load skeleton file.");
+
+        if (!applyBoneMask(boneMaskFileName, skeleton, boneMask, compressionSettings))
+            FATAL_ERROR("Failed to load bone mask file.");
+
+        FbxScene* lScene = importScene(lManager, srcFileName.c_str(), true, fullImport);
+        if (lScene == nullptr)
+            FATAL_ERROR("Failed to import FBX file.");
+
+        std::vector<ClipRange> clipRanges;
+
+        if (takeClips)
+            getTakeClipRanges(lScene, clipRanges);
+
+        else if (lScene->GetCurrentAnimationStack() == nullptr)
+            FATAL_ERROR("Failed to find animation data in FBX file.");
+
+        else if (!loadClipRanges(clipsFileName.c_str(), lScene->GetCurrentAnimationStack(), clipRanges))
+            FATAL_ERROR("Failed to load clip file.");
+
+        if (clipRanges.empty())
+            FATAL_ERROR("Failed to find any clips.");
+
+        // Every clip is saved to a file named after it, so names have to be unique, also when ignoring case.
+        std::unordered_set<std::string> usedFileNames;
+
+        for (auto& clipRange : clipRanges)
+        {
+            if (!takeClips && (clipRange.start < 0.0 || clipRange.start >= clipRange.end))
+                FATAL_ERROR(("Clip \"" + clipRange.name + "\" has an invalid time range.").c_str());
+
+            const std::string fileName = getValidFileName(clipRange.name);
+
+            if (getUniqueFileName(fileName, usedFileNames) != fileName)
+                FATAL_ERROR(("Multiple clips are named \"" + clipRange.name + "\".").c_str());
+        }
+
+        std::vector<SampledAnimation> sampledAnimations;
+
+        if (!sampleClips(lScene, skeleton, fps, clipRanges, sampledAnimations))
+            FATAL_ERROR("Failed to find animation data in FBX file.");
+
+        lScene->Destroy();
+
+        const std::string directoryName = getDirectoryName(dstFileName);
+        const std::string originalSkeletonName = getFileNameWithoutExtension(sklFileName);
+
+        std::atomic<bool> saved(true);
+
+        // Compression and serialization only involve Havok, so every clip is processed concurrently.
+        parallelFor(clipRanges.size(), [&](size_t i)
+        {
+            maskTracks(sampledAnimations[i], skeleton, compressionSettings);
+
+            hkaAnimationBinding* animationBinding = createFittedAnimationAndBinding(clipRanges[i].name.c_str(),
+                sampledAnimations[i], skeleton, originalSkeletonName.c_str(), compressionSettings);
+
+            if (!saveAnimationBinding((directoryName + getValidFileName(clipRanges[i].name) + ".anm.hkx").c_str(), animationBinding, outputSettings))
+                saved = false;
+
+            releaseAnimationBinding(animationBinding);
+        });
+
+        return closeArchive(archive, saved);
+    }
+
     hkArray<HK_REF_PTR(Animation)> animations;
     hkArray<HK_REF_PTR(hkaAnimationBinding)> bindings;
     hkArray<HK_REF_PTR(hkaSkeleton)> skeletons;
 
+    std::atomic<bool> saved(true);
+
     if (!sklFileName.empty())
     {
         hkaSkeleton* skeleton = loadSkeleton(sklFileName.c_str());
@@ -564,17 +3626,123 @@ int main(int argc, const char** argv)
         if (skeleton == nullptr)
             FATAL_ERROR("Failed to load skeleton file.");
 
-        hkaAnimationBinding* animationBinding = createAnimationAndBinding(lScene, skeleton, getFileNameWithoutExtension(sklFileName).c_str(), compress, fps);
+        if (!applyBoneMask(boneMaskFileName, skeleton, boneMask, compressionSettings))
+            FATAL_ERROR("Failed to load bone mask file.");
 
-        if (animationBinding == nullptr)
-            FATAL_ERROR("Failed to find animation data in FBX file.");
+        uint64_t skeletonHash = 0;
+        computeFileHash(sklFileName.c_str(), skeletonHash);
+
+        // The animation comes first, followed by its LOD variants.
+        std::vector<std::string> variantSuffixes(1);
+        std::vector<double> variantFps(1, fps);
+        std::vector<CompressionSettings> variantSettings(1, compressionSettings);
+
+        for (auto& lodVariant : lodVariants)
+        {
+            CompressionSettings settings = compressionSettings;
+
+            if (lodVariant.rotationTolerance >= 0.0f)
+                settings.rotationTolerance = lodVariant.rotationTolerance;
+
+            if (lodVariant.translationTolerance >= 0.0f)
+                settings.translationTolerance = lodVariant.translationTolerance;
+
+            if (lodVariant.scaleTolerance >= 0.0f)
+                settings.scaleTolerance = lodVariant.scaleTolerance;
+
+            if (!applyBoneMask(lodVariant.boneMaskFileName, skeleton, lodVariant.boneMask, settings))
+                FATAL_ERROR("Failed to load bone mask file.");
 
-        animations.pushBack(animationBinding->m_animation);
-        bindings.pushBack(animationBinding);
+            variantSuffixes.push_back(lodVariant.suffix);
+            variantFps.push_back(lodVariant.fps > 0.0 ? lodVariant.fps : fps);
+            variantSettings.push_back(settings);
+        }
+
+        // Sample once at the highest frame rate. Every variant is resampled from these poses instead of the FBX file.
+        const double sourceFps = *std::max_element(variantFps.begin(), variantFps.end());
+
+        SampledAnimation sourceAnimation;
+
+        const char* error = getSampledAnimation(lManager, srcFileName, skeleton, skeletonHash, cacheDirectory, sourceFps, fullImport, sourceAnimation);
+        if (error != nullptr)
+            FATAL_ERROR(error);
+
+        // Mirrored and additive clips are derived from the sampled poses, before any mask, and get the same LOD variants.
+        std::vector<const SampledAnimation*> sourceAnimations(1, &sourceAnimation);
+        std::vector<std::string> sourceSuffixes(1);
+
+        SampledAnimation mirroredAnimation;
+
+        if (!bonePairsFileName.empty())
+        {
+            std::vector<int> bonePairs;
+
+            if (!loadBonePairs(bonePairsFileName.c_str(), skeleton, bonePairs))
+                FATAL_ERROR("Failed to load bone pair file.");
+
+            if (!mirrorAnimation(sourceAnimation, skeleton, bonePairs, mirrorAxis, mirroredAnimation))
+                FATAL_ERROR("Failed to mirror animation.");
+
+            sourceAnimations.push_back(&mirroredAnimation);
+            sourceSuffixes.push_back("_mirror");
+        }
+
+        SampledAnimation additiveAnimation;
+
+        if (additive)
+        {
+            SampledAnimation baseAnimation;
+
+            if (!additiveBaseFileName.empty())
+            {
+                error = getSampledAnimation(lManager, additiveBaseFileName, skeleton, skeletonHash, cacheDirectory, sourceFps, fullImport, baseAnimation);
+                if (error != nullptr)
+                    FATAL_ERROR((additiveBaseFileName + ": " + error).c_str());
+            }
+
+            makeAdditiveAnimation(sourceAnimation, skeleton, additiveBaseFileName.empty() ? nullptr : &baseAnimation, additiveAnimation);
+
+            sourceAnimations.push_back(&additiveAnimation);
+            sourceSuffixes.push_back("_additive");
+        }
+
+        const std::string originalSkeletonName = getFileNameWithoutExtension(sklFileName);
+
+        const size_t variantCount = variantSettings.size();
+        std::vector<hkaAnimationBinding*> variantBindings(sourceAnimations.size() * variantCount);
+
+        parallelFor(variantBindings.size(), [&](size_t i)
+        {
+            const size_t sourceIndex = i / variantCount;
+            const size_t variantIndex = i % variantCount;
+
+            SampledAnimation sampledAnimation;
+            deriveLodAnimation(*sourceAnimations[sourceIndex], sourceFps, variantFps[variantIndex], skeleton, variantSettings[variantIndex], sampledAnimation);
+
+            const std::string suffix = sourceSuffixes[sourceIndex] + variantSuffixes[variantIndex];
+
+            variantBindings[i] = createFittedAnimationAndBinding((getFileNameWithoutExtension(dstFileName) + suffix).c_str(),
+                sampledAnimation, skeleton, originalSkeletonName.c_str(), variantSettings[variantIndex]);
+
+            if (i == 0)
+                return;
+
+            if (!saveAnimationBinding(insertFileNameSuffix(dstFileName, suffix).c_str(), variantBindings[i], outputSettings))
+                saved = false;
+
+            releaseAnimationBinding(variantBindings[i]);
+        });
+
+        animations.pushBack(variantBindings[0]->m_animation);
+        bindings.pushBack(variantBindings[0]);
     }
 
     else
     {
+        FbxScene* lScene = importScene(lManager, srcFileName.c_str(), false, fullImport);
+        if (lScene == nullptr)
+            FATAL_ERROR("Failed to import FBX file.");
+
         FbxNode* lRootNode = lScene->GetRootNode();
 
         for (int i = 0; i < lRootNode->GetChildCount(); i++)
@@ -584,49 +3752,52 @@ int main(int argc, const char** argv)
             if (!checkIsSkeleton(lNode))
                 continue;
 
-            hkaSkeleton* skeleton = createSkeleton(lNode, getFileNameWithoutExtension(dstFileName).c_str());
+            // Skeletons are named after their root nodes when exporting more than one.
+            hkaSkeleton* skeleton = createSkeleton(lNode, allSkeletons ? lNode->GetName() : getFileNameWithoutExtension(dstFileName).c_str());
             if (skeleton == nullptr)
                 continue;
             
             skeletons.pushBack(skeleton);
-            break;
+
+            if (!allSkeletons)
+                break;
         }
 
         if (skeletons.isEmpty())
             FATAL_ERROR("Failed to find skeleton data in FBX file.");
     }
 
-#if _2010 || _2012
-    animationContainer.m_animations = std::move(animations);
-    animationContainer.m_bindings = std::move(bindings);
-    animationContainer.m_skeletons = std::move(skeletons);
-#elif _550
-    toPtrArray(animations, animationContainer.m_animations, animationContainer.m_numAnimations);
-    toPtrArray(bindings, animationContainer.m_bindings, animationContainer.m_numBindings);
-    toPtrArray(skeletons, animationContainer.m_skeletons, animationContainer.m_numSkeletons);
-#endif
-
-    hkRootLevelContainer levelContainer;
+    if (splitSkeletons)
+    {
+        const std::string directoryName = getDirectoryName(dstFileName);
 
-    hkArray<hkRootLevelContainer::NamedVariant> namedVariants;
-    namedVariants.pushBack(hkRootLevelContainer::NamedVariant(sklFileName.empty() ? "Animation Container" : "Merged Animation Container", &animationContainer, &hkaAnimationContainerClass));
+        std::vector<std::string> dstFilePaths;
+        std::unordered_set<std::string> usedFileNames;
 
+        for (int i = 0; i < skeletons.getSize(); i++)
+        {
 #if _2010 || _2012
-    levelContainer.m_namedVariants = std::move(namedVariants);
+            const std::string fileName = getValidFileName(skeletons[i]->m_name.cString());
 #elif _550
-    toPtrArray(namedVariants, levelContainer.m_namedVariants, levelContainer.m_numNamedVariants);
+            const std::string fileName = getValidFileName(skeletons[i]->m_name);
 #endif
+            // Sibling roots may share a name, which would make them write to the same file.
+            dstFilePaths.push_back(directoryName + getUniqueFileName(fileName, usedFileNames) + ".skl.hkx");
+        }
 
-#if _2010 || _2012
-    if (saveTagfile)
-    {
-        hkSerializeUtil::saveTagfile(&levelContainer, hkRootLevelContainerClass, hkOstream(dstFileName.c_str()).getStreamWriter());
-    }
-    else
-#endif
-    {
-        savePackfile(dstFileName.c_str(), &levelContainer, layout);
+        parallelFor(dstFilePaths.size(), [&](size_t i)
+        {
+            if (!saveSkeleton(dstFilePaths[i].c_str(), skeletons[(int)i], outputSettings))
+                saved = false;
+        });
+
+        return closeArchive(archive, saved);
     }
 
-    return 0;
+    setAnimationContainer(animationContainer, animations, bindings, skeletons);
+
+    if (!saveAnimationContainer(dstFileName.c_str(), &animationContainer, sklFileName.empty() ? "Animation Container" : "Merged Animation Container", outputSettings))
+        saved = false;
+
+    return closeArchive(archive, saved);
 }
\ No newline at end of file
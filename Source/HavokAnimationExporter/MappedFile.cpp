@@ -0,0 +1,113 @@
+#include "Pch.h"
+#include "MappedFile.h"
+
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const char* filePath)
+{
+    close();
+
+    HANDLE fileHandle = CreateFileA(filePath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+        return false;
+
+    file = fileHandle;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(fileHandle, &fileSize))
+    {
+        close();
+        return false;
+    }
+
+    // Empty files cannot be mapped, but are still valid.
+    if (fileSize.QuadPart == 0)
+        return true;
+
+    mapping = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr)
+    {
+        close();
+        return false;
+    }
+
+    data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (data == nullptr)
+    {
+        close();
+        return false;
+    }
+
+    dataSize = (size_t)fileSize.QuadPart;
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (data != nullptr)
+        UnmapViewOfFile(data);
+
+    if (mapping != nullptr)
+        CloseHandle(mapping);
+
+    if (file != nullptr)
+        CloseHandle(file);
+
+    data = nullptr;
+    dataSize = 0;
+    mapping = nullptr;
+    file = nullptr;
+}
+
+bool writeFileAtomic(const char* filePath, const void* data, size_t dataSize, bool skipUnchanged)
+{
+    if (skipUnchanged)
+    {
+        MappedFile existingFile;
+
+        if (existingFile.open(filePath) && existingFile.dataSize == dataSize &&
+            (dataSize == 0 || memcmp(existingFile.data, data, dataSize) == 0))
+            return true;
+    }
+
+    // Concurrent writers to the same destination each need their own temporary file.
+    static std::atomic<unsigned int> tempFileCounter(0);
+
+    char tempFileSuffix[32];
+    sprintf(tempFileSuffix, ".%lx.%x.tmp", GetCurrentProcessId(), tempFileCounter++);
+
+    const std::string tempFilePath = std::string(filePath) + tempFileSuffix;
+
+    HANDLE fileHandle = CreateFileA(tempFilePath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+        return false;
+
+    bool result = true;
+
+    // WriteFile takes 32-bit sizes, so only files over 1 GB need more than one call.
+    for (size_t offset = 0; offset < dataSize && result;)
+    {
+        const DWORD size = (DWORD)std::min<size_t>(dataSize - offset, 1 << 30);
+        DWORD writtenSize = 0;
+
+        result = WriteFile(fileHandle, (const char*)data + offset, size, &writtenSize, nullptr) && writtenSize == size;
+        offset += size;
+    }
+
+    CloseHandle(fileHandle);
+
+    if (!result || !MoveFileExA(tempFilePath.c_str(), filePath, MOVEFILE_REPLACE_EXISTING))
+    {
+        DeleteFileA(tempFilePath.c_str());
+        return false;
+    }
+
+    return true;
+}
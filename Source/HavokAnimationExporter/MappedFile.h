@@ -0,0 +1,26 @@
+#pragma once
+
+// Read-only memory mapping of a whole file.
+class MappedFile
+{
+public:
+    const void* data = nullptr;
+    size_t dataSize = 0;
+
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    bool open(const char* filePath);
+    void close();
+
+private:
+    void* file = nullptr;
+    void* mapping = nullptr;
+};
+
+// Writes the data to a uniquely named temporary file next to the destination with a single write, then renames it over the destination,
+// so a killed run never leaves a truncated file behind. With skipUnchanged, a file that already holds the same bytes
+// is left untouched, keeping its modification time.
+bool writeFileAtomic(const char* filePath, const void* data, size_t dataSize, bool skipUnchanged);
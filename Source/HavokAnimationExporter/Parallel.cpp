@@ -0,0 +1,123 @@
+#include "Pch.h"
+#include "Parallel.h"
+
+namespace
+{
+    // Set while a thread runs parallelFor work. Nested calls then run inline on that thread,
+    // as the outer call already keeps every core busy.
+    thread_local bool parallelForWorker = false;
+
+    class HavokThreadContext
+    {
+    public:
+#if _2010 || _2012
+        hkMemoryRouter memoryRouter;
+
+        HavokThreadContext()
+        {
+            hkMemorySystem::getInstance().threadInit(memoryRouter, "HavokAnimationExporter");
+            hkBaseSystem::initThread(&memoryRouter);
+        }
+
+        ~HavokThreadContext()
+        {
+            hkBaseSystem::quitThread();
+            hkMemorySystem::getInstance().threadQuit(memoryRouter);
+        }
+#elif _550
+        hkThreadMemory threadMemory;
+        std::vector<char> stackArea;
+
+        HavokThreadContext()
+            : threadMemory(&hkMemory::getInstance(), 16), stackArea(1024 * 1024)
+        {
+            threadMemory.setStackArea(stackArea.data(), (int)stackArea.size());
+            hkBaseSystem::initThread(&threadMemory);
+        }
+
+        ~HavokThreadContext()
+        {
+            threadMemory.setStackArea(nullptr, 0);
+            hkBaseSystem::clearThreadResources();
+        }
+#endif
+    };
+}
+
+size_t getWorkerCount()
+{
+    return std::max<size_t>(1, std::thread::hardware_concurrency());
+}
+
+void parallelFor(size_t count, const std::function<void(size_t)>& function, bool initHavok)
+{
+    const size_t workerCount = parallelForWorker ? 1 : std::min(count, getWorkerCount());
+
+    if (workerCount <= 1)
+    {
+        for (size_t i = 0; i < count; i++)
+            function(i);
+
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+
+    auto work = [&]()
+    {
+        parallelForWorker = true;
+
+        size_t i;
+        while ((i = next++) < count)
+            function(i);
+
+        parallelForWorker = false;
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(workerCount - 1);
+
+    // The calling thread is already set up for Havok if needed, and takes part in the work.
+    for (size_t i = 1; i < workerCount; i++)
+    {
+        threads.emplace_back([&]()
+        {
+            if (!initHavok)
+            {
+                work();
+                return;
+            }
+
+            HavokThreadContext context;
+            work();
+        });
+    }
+
+    work();
+
+    for (auto& thread : threads)
+        thread.join();
+}
+
+void parallelInvoke(const std::vector<std::function<void()>>& functions)
+{
+    if (functions.empty())
+        return;
+
+    std::vector<std::thread> threads;
+    threads.reserve(functions.size() - 1);
+
+    for (size_t i = 1; i < functions.size(); i++)
+    {
+        threads.emplace_back([&functions, i]()
+        {
+            HavokThreadContext context;
+            functions[i]();
+        });
+    }
+
+    functions[0]();
+
+    for (auto& thread : threads)
+        thread.join();
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+// Calls function(i) for every i in [0, count) on a pool of worker threads.
+// Every worker is set up for Havok allocations, so the function may create Havok objects. Work that doesn't touch Havok
+// can pass initHavok as false, which also allows calling this before Havok is initialized.
+// FBX SDK objects must not be shared between concurrent calls. Calls made from within a parallelFor run serially
+// on the calling worker, while a call over a single item leaves nested calls free to spread out.
+void parallelFor(size_t count, const std::function<void(size_t)>& function, bool initHavok = true);
+
+// Calls every function on its own thread, set up for Havok like the parallelFor workers, and waits for all of them.
+// Meant for long-running stages that hand work to each other.
+void parallelInvoke(const std::vector<std::function<void()>>& functions);
+
+// Number of workers used by parallelFor.
+size_t getWorkerCount();
@@ -1,9 +1,20 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <list>
+#include <map>
+#include <memory>
 
 #include <fbxsdk.h>
 
@@ -39,6 +50,7 @@
 #include <Common/Base/System/Error/hkDefaultError.h>
 #include <Common/Base/System/hkBaseSystem.h>
 #include <Common/Base/System/Io/IStream/hkIStream.h>
+#include <Common/Base/System/Io/Writer/Array/hkArrayStreamWriter.h>
 #include <Common/SceneData/Graph/hkxNode.h>
 #include <Common/SceneData/Scene/hkxScene.h>
 
@@ -0,0 +1,346 @@
+#include "Pch.h"
+#include "PoseBuffer.h"
+
+#include <xmmintrin.h>
+
+void PoseBuffer::resize(int trackCount, int frameCount)
+{
+    this->trackCount = trackCount;
+    this->frameCount = frameCount;
+
+    const int count = trackCount * frameCount;
+
+    rotationX.resize(count);
+    rotationY.resize(count);
+    rotationZ.resize(count);
+    rotationW.resize(count);
+
+    translations.setSize(count);
+    scales.setSize(count);
+}
+
+void PoseBuffer::setFrame(int frame, const hkQsTransform* transforms)
+{
+    for (int i = 0, index = frame; i < trackCount; i++, index += frameCount)
+    {
+        const hkQsTransform& transform = transforms[i];
+
+        rotationX[index] = transform.m_rotation.m_vec(0);
+        rotationY[index] = transform.m_rotation.m_vec(1);
+        rotationZ[index] = transform.m_rotation.m_vec(2);
+        rotationW[index] = transform.m_rotation.m_vec(3);
+
+        translations[index] = transform.m_translation;
+        scales[index] = transform.m_scale;
+    }
+}
+
+void PoseBuffer::getFrame(int frame, hkQsTransform* transforms) const
+{
+    for (int i = 0, index = frame; i < trackCount; i++, index += frameCount)
+    {
+        hkQsTransform& transform = transforms[i];
+
+        transform.m_rotation.m_vec.set(rotationX[index], rotationY[index], rotationZ[index], rotationW[index]);
+        transform.m_translation = translations[index];
+        transform.m_scale = scales[index];
+    }
+}
+
+void PoseBuffer::copyTrack(int track, const PoseBuffer& source, int sourceTrack)
+{
+    const int offset = track * frameCount;
+    const int sourceOffset = sourceTrack * source.frameCount;
+
+    memcpy(&rotationX[offset], &source.rotationX[sourceOffset], frameCount * sizeof(float));
+    memcpy(&rotationY[offset], &source.rotationY[sourceOffset], frameCount * sizeof(float));
+    memcpy(&rotationZ[offset], &source.rotationZ[sourceOffset], frameCount * sizeof(float));
+    memcpy(&rotationW[offset], &source.rotationW[sourceOffset], frameCount * sizeof(float));
+
+    memcpy(&translations[offset], &source.translations[sourceOffset], frameCount * sizeof(hkVector4));
+    memcpy(&scales[offset], &source.scales[sourceOffset], frameCount * sizeof(hkVector4));
+}
+
+void PoseBuffer::copyFrames(int frame, const PoseBuffer& source, int sourceFrame, int count)
+{
+    for (int i = 0; i < trackCount; i++)
+    {
+        const int offset = i * frameCount + frame;
+        const int sourceOffset = i * source.frameCount + sourceFrame;
+
+        memcpy(&rotationX[offset], &source.rotationX[sourceOffset], count * sizeof(float));
+        memcpy(&rotationY[offset], &source.rotationY[sourceOffset], count * sizeof(float));
+        memcpy(&rotationZ[offset], &source.rotationZ[sourceOffset], count * sizeof(float));
+        memcpy(&rotationW[offset], &source.rotationW[sourceOffset], count * sizeof(float));
+
+        memcpy(&translations[offset], &source.translations[sourceOffset], count * sizeof(hkVector4));
+        memcpy(&scales[offset], &source.scales[sourceOffset], count * sizeof(hkVector4));
+    }
+}
+
+void PoseBuffer::fillTrack(int track, const hkQsTransform& transform)
+{
+    const int offset = track * frameCount;
+
+    std::fill_n(&rotationX[offset], frameCount, (float)transform.m_rotation.m_vec(0));
+    std::fill_n(&rotationY[offset], frameCount, (float)transform.m_rotation.m_vec(1));
+    std::fill_n(&rotationZ[offset], frameCount, (float)transform.m_rotation.m_vec(2));
+    std::fill_n(&rotationW[offset], frameCount, (float)transform.m_rotation.m_vec(3));
+
+    for (int i = 0; i < frameCount; i++)
+    {
+        translations[offset + i] = transform.m_translation;
+        scales[offset + i] = transform.m_scale;
+    }
+}
+
+void PoseBuffer::resample(const PoseBuffer& source, int frameCount)
+{
+    resize(source.trackCount, frameCount);
+
+    const double step = frameCount > 1 ? (double)(source.frameCount - 1) / (frameCount - 1) : 0.0;
+
+    for (int i = 0; i < trackCount; i++)
+    {
+        const int offset = i * frameCount;
+        const int sourceOffset = i * source.frameCount;
+
+        for (int j = 0; j < frameCount; j++)
+        {
+            const double position = j * step;
+            const int frame = std::min<int>((int)position, source.frameCount - 1);
+            const int nextFrame = std::min<int>(frame + 1, source.frameCount - 1);
+            const float t = (float)(position - frame);
+
+            const int index = sourceOffset + frame;
+            const int nextIndex = sourceOffset + nextFrame;
+
+            // Neighbours are unrolled already, but interpolate towards the closer hemisphere regardless.
+            const float dot = source.rotationX[index] * source.rotationX[nextIndex] + source.rotationY[index] * source.rotationY[nextIndex] +
+                source.rotationZ[index] * source.rotationZ[nextIndex] + source.rotationW[index] * source.rotationW[nextIndex];
+
+            const float sign = dot < 0.0f ? -1.0f : 1.0f;
+
+            rotationX[offset + j] = source.rotationX[index] + (sign * source.rotationX[nextIndex] - source.rotationX[index]) * t;
+            rotationY[offset + j] = source.rotationY[index] + (sign * source.rotationY[nextIndex] - source.rotationY[index]) * t;
+            rotationZ[offset + j] = source.rotationZ[index] + (sign * source.rotationZ[nextIndex] - source.rotationZ[index]) * t;
+            rotationW[offset + j] = source.rotationW[index] + (sign * source.rotationW[nextIndex] - source.rotationW[index]) * t;
+
+            float translation[3];
+            float scale[3];
+
+            for (int k = 0; k < 3; k++)
+            {
+                translation[k] = (float)source.translations[index](k) + ((float)source.translations[nextIndex](k) - (float)source.translations[index](k)) * t;
+                scale[k] = (float)source.scales[index](k) + ((float)source.scales[nextIndex](k) - (float)source.scales[index](k)) * t;
+            }
+
+            translations[offset + j].set(translation[0], translation[1], translation[2], (float)source.translations[index](3));
+            scales[offset + j].set(scale[0], scale[1], scale[2], (float)source.scales[index](3));
+        }
+    }
+
+    unrollRotations();
+}
+
+bool PoseBuffer::checkIsTrackConstant(int track, const hkQsTransform& transform, float rotationTolerance, float translationTolerance, float scaleTolerance) const
+{
+    const int offset = track * frameCount;
+
+    const float rotation[] = { (float)transform.m_rotation.m_vec(0), (float)transform.m_rotation.m_vec(1), (float)transform.m_rotation.m_vec(2), (float)transform.m_rotation.m_vec(3) };
+
+    for (int i = offset; i < offset + frameCount; i++)
+    {
+        const float frameRotation[] = { rotationX[i], rotationY[i], rotationZ[i], rotationW[i] };
+
+        float sameDifference = 0.0f;
+        float flippedDifference = 0.0f;
+
+        for (int j = 0; j < 4; j++)
+        {
+            sameDifference = std::max<float>(sameDifference, fabsf(frameRotation[j] - rotation[j]));
+            flippedDifference = std::max<float>(flippedDifference, fabsf(frameRotation[j] + rotation[j]));
+        }
+
+        if (std::min<float>(sameDifference, flippedDifference) > rotationTolerance)
+            return false;
+
+        for (int j = 0; j < 3; j++)
+        {
+            if (fabsf((float)translations[i](j) - (float)transform.m_translation(j)) > translationTolerance ||
+                fabsf((float)scales[i](j) - (float)transform.m_scale(j)) > scaleTolerance)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+namespace
+{
+    int quantizeValue(float value, float step)
+    {
+        if (step <= 0.0f)
+        {
+            int bits;
+            memcpy(&bits, &value, sizeof(bits));
+            return bits;
+        }
+
+        // Converting values outside the int range is undefined, so they are clamped. NaN ends up at the lower bound.
+        const double steps = floor((double)value / step + 0.5);
+
+        if (!(steps > (double)INT32_MIN))
+            return INT32_MIN;
+
+        if (steps > (double)INT32_MAX)
+            return INT32_MAX;
+
+        return (int)steps;
+    }
+}
+
+void PoseBuffer::quantize(float rotationStep, float translationStep, float scaleStep, std::vector<int>& values) const
+{
+    size_t offset = values.size();
+    values.resize(offset + 2 + (size_t)trackCount * frameCount * 10);
+
+    values[offset++] = trackCount;
+    values[offset++] = frameCount;
+
+    for (int i = 0; i < trackCount * frameCount; i++)
+    {
+        int* frameValues = &values[offset + i * 10];
+
+        frameValues[0] = quantizeValue(rotationX[i], rotationStep);
+        frameValues[1] = quantizeValue(rotationY[i], rotationStep);
+        frameValues[2] = quantizeValue(rotationZ[i], rotationStep);
+        frameValues[3] = quantizeValue(rotationW[i], rotationStep);
+
+        for (int k = 0; k < 3; k++)
+        {
+            frameValues[4 + k] = quantizeValue((float)translations[i](k), translationStep);
+            frameValues[7 + k] = quantizeValue((float)scales[i](k), scaleStep);
+        }
+    }
+}
+
+void PoseBuffer::getTransforms(hkQsTransform* transforms) const
+{
+    for (int i = 0; i < frameCount; i++)
+        getFrame(i, &transforms[i * trackCount]);
+}
+
+static void normalizeRotations(float* x, float* y, float* z, float* w, int count)
+{
+    int i = 0;
+
+    const __m128 one = _mm_set1_ps(1.0f);
+
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 qx = _mm_loadu_ps(x + i);
+        __m128 qy = _mm_loadu_ps(y + i);
+        __m128 qz = _mm_loadu_ps(z + i);
+        __m128 qw = _mm_loadu_ps(w + i);
+
+        __m128 lengthSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(qx, qx), _mm_mul_ps(qy, qy)), _mm_add_ps(_mm_mul_ps(qz, qz), _mm_mul_ps(qw, qw)));
+
+        // Full precision division instead of _mm_rsqrt_ps, which is too lossy for spline fitting.
+        __m128 invLength = _mm_div_ps(one, _mm_sqrt_ps(lengthSquared));
+
+        _mm_storeu_ps(x + i, _mm_mul_ps(qx, invLength));
+        _mm_storeu_ps(y + i, _mm_mul_ps(qy, invLength));
+        _mm_storeu_ps(z + i, _mm_mul_ps(qz, invLength));
+        _mm_storeu_ps(w + i, _mm_mul_ps(qw, invLength));
+    }
+
+    for (; i < count; i++)
+    {
+        const float invLength = 1.0f / sqrtf(x[i] * x[i] + y[i] * y[i] + z[i] * z[i] + w[i] * w[i]);
+
+        x[i] *= invLength;
+        y[i] *= invLength;
+        z[i] *= invLength;
+        w[i] *= invLength;
+    }
+}
+
+// Computes dots[i] = dot(q[i], q[i - 1]) for i in [1, count).
+static void dotPreviousRotations(const float* x, const float* y, const float* z, const float* w, float* dots, int count)
+{
+    int i = 1;
+
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 dot = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(x + i - 1)), _mm_mul_ps(_mm_loadu_ps(y + i), _mm_loadu_ps(y + i - 1))),
+            _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(z + i), _mm_loadu_ps(z + i - 1)), _mm_mul_ps(_mm_loadu_ps(w + i), _mm_loadu_ps(w + i - 1))));
+
+        _mm_storeu_ps(dots + i, dot);
+    }
+
+    for (; i < count; i++)
+        dots[i] = x[i] * x[i - 1] + y[i] * y[i - 1] + z[i] * z[i - 1] + w[i] * w[i - 1];
+}
+
+static void multiplyRotations(float* x, float* y, float* z, float* w, const float* signs, int count)
+{
+    int i = 0;
+
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 sign = _mm_loadu_ps(signs + i);
+
+        _mm_storeu_ps(x + i, _mm_mul_ps(_mm_loadu_ps(x + i), sign));
+        _mm_storeu_ps(y + i, _mm_mul_ps(_mm_loadu_ps(y + i), sign));
+        _mm_storeu_ps(z + i, _mm_mul_ps(_mm_loadu_ps(z + i), sign));
+        _mm_storeu_ps(w + i, _mm_mul_ps(_mm_loadu_ps(w + i), sign));
+    }
+
+    for (; i < count; i++)
+    {
+        x[i] *= signs[i];
+        y[i] *= signs[i];
+        z[i] *= signs[i];
+        w[i] *= signs[i];
+    }
+}
+
+void PoseBuffer::unrollRotations()
+{
+    std::vector<float> signs(frameCount);
+
+    for (int i = 0; i < trackCount; i++)
+    {
+        const int offset = i * frameCount;
+
+        float* x = &rotationX[offset];
+        float* y = &rotationY[offset];
+        float* z = &rotationZ[offset];
+        float* w = &rotationW[offset];
+
+        normalizeRotations(x, y, z, w, frameCount);
+
+        // Dots between unflipped neighbours only depend on the input, so they can be computed in bulk.
+        // Whether a frame gets flipped then only depends on whether its predecessor got flipped.
+        dotPreviousRotations(x, y, z, w, signs.data(), frameCount);
+
+        bool flip = w[0] < 0.0f;
+        signs[0] = flip ? -1.0f : 1.0f;
+
+        for (int j = 1; j < frameCount; j++)
+        {
+            const float dot = signs[j];
+
+            if (dot < 0.0f)
+                flip = !flip;
+            else if (dot == 0.0f)
+                flip = false;
+
+            signs[j] = flip ? -1.0f : 1.0f;
+        }
+
+        multiplyRotations(x, y, z, w, signs.data(), frameCount);
+    }
+}
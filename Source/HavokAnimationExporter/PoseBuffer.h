@@ -0,0 +1,72 @@
+#pragma once
+
+// Sampled local poses stored track-major as separate rotation, translation and scale streams,
+// so per-track passes run over contiguous memory. Entry [track * frameCount + frame] of each stream
+// belongs to the given track and frame. Rotations are split into one stream per component for SIMD.
+struct PoseBuffer
+{
+    int trackCount = 0;
+    int frameCount = 0;
+
+    std::vector<float> rotationX;
+    std::vector<float> rotationY;
+    std::vector<float> rotationZ;
+    std::vector<float> rotationW;
+
+    hkArray<hkVector4> translations;
+    hkArray<hkVector4> scales;
+
+    void resize(int trackCount, int frameCount);
+
+    // Scatters/gathers one frame of trackCount transforms.
+    void setFrame(int frame, const hkQsTransform* transforms);
+    void getFrame(int frame, hkQsTransform* transforms) const;
+
+    // Copies every frame of a track from another buffer with the same frame count.
+    void copyTrack(int track, const PoseBuffer& source, int sourceTrack);
+
+    // Copies a range of frames for every track from another buffer with the same track count.
+    void copyFrames(int frame, const PoseBuffer& source, int sourceFrame, int count);
+
+    // Sets every frame of a track to the same transform.
+    void fillTrack(int track, const hkQsTransform& transform);
+
+    // Resamples another buffer to the given frame count over the same duration, so the first and last frames
+    // stay in place. Frames in between are interpolated linearly, and rotations get normalized and unrolled.
+    void resample(const PoseBuffer& source, int frameCount);
+
+    // Whether every frame of a track is within the tolerances of the transform. Rotations match in either hemisphere.
+    bool checkIsTrackConstant(int track, const hkQsTransform& transform, float rotationTolerance, float translationTolerance, float scaleTolerance) const;
+
+    // Writes every frame into Havok's interleaved layout, frame after frame.
+    void getTransforms(hkQsTransform* transforms) const;
+
+    // Appends the track and frame counts, then every track after rounding rotations, translations and scales to multiples
+    // of the given steps, so poses that only differ by less than the compression tolerance usually give the same values.
+    // A step of 0 keeps exact values.
+    void quantize(float rotationStep, float translationStep, float scaleStep, std::vector<int>& values) const;
+
+    // Normalizes rotations and keeps every track in the same hemisphere
+    // as its previous frame, so spline compression doesn't flicker.
+    void unrollRotations();
+};
+
+// Annotation on a bone, in seconds from the start of the animation.
+struct SampledAnnotation
+{
+    int boneIndex;
+    float time;
+    std::string text;
+};
+
+// Animation sampled from a source, after quaternion unrolling, ready for compression.
+struct SampledAnimation
+{
+    double duration = 0.0;
+    hkArray<hkInt16> transformTrackToBoneIndices;
+    PoseBuffer poses;
+    std::vector<SampledAnnotation> annotations;
+
+    // Poses are deltas to add on top of another animation, rather than local poses.
+    bool additive = false;
+};
@@ -0,0 +1,211 @@
+#include "Pch.h"
+#include "PoseCache.h"
+#include "PoseBuffer.h"
+#include "MappedFile.h"
+
+#include <direct.h>
+
+// File layout, every block aligned to 16 bytes so the file can be used straight from a mapping:
+//   PoseCacheHeader
+//   hkInt16 transformTrackToBoneIndices[trackCount]
+//   float rotationX[count], rotationY[count], rotationZ[count], rotationW[count]
+//   hkVector4 translations[count], scales[count]
+//   PoseCacheAnnotation annotations[annotationCount]
+//   char text[textSize], referenced by the annotations
+// where count is trackCount * frameCount, and streams are track-major like PoseBuffer.
+
+namespace
+{
+    struct PoseCacheHeader
+    {
+        char magic[4];
+        unsigned int version;
+        uint64_t fbxHash;
+        uint64_t skeletonHash;
+        double fps;
+        double duration;
+        int trackCount;
+        int frameCount;
+        unsigned int annotationCount;
+        unsigned int textSize;
+    };
+
+    struct PoseCacheAnnotation
+    {
+        int boneIndex;
+        float time;
+        unsigned int textOffset;
+        unsigned int textSize;
+    };
+
+    const char POSE_CACHE_MAGIC[4] = { 'H', 'A', 'E', 'P' };
+    const unsigned int POSE_CACHE_VERSION = 2;
+
+    size_t align(size_t offset)
+    {
+        return (offset + 0xF) & ~0xF;
+    }
+
+    struct PoseCacheLayout
+    {
+        size_t indicesOffset;
+        size_t rotationsOffset;
+        size_t translationsOffset;
+        size_t scalesOffset;
+        size_t annotationsOffset;
+        size_t textOffset;
+        size_t fileSize;
+
+        PoseCacheLayout(int trackCount, int frameCount, unsigned int annotationCount, unsigned int textSize)
+        {
+            const size_t count = (size_t)trackCount * frameCount;
+
+            indicesOffset = align(sizeof(PoseCacheHeader));
+            rotationsOffset = align(indicesOffset + trackCount * sizeof(hkInt16));
+            translationsOffset = align(rotationsOffset + 4 * count * sizeof(float));
+            scalesOffset = translationsOffset + count * 4 * sizeof(float);
+            annotationsOffset = scalesOffset + count * 4 * sizeof(float);
+            textOffset = annotationsOffset + annotationCount * sizeof(PoseCacheAnnotation);
+            fileSize = textOffset + textSize;
+        }
+    };
+}
+
+std::string getPoseCacheFilePath(const std::string& directoryPath, const PoseCacheKey& key)
+{
+    _mkdir(directoryPath.c_str());
+
+    uint64_t fps;
+    memcpy(&fps, &key.fps, sizeof(fps));
+
+    char fileName[64];
+    sprintf(fileName, "%016llx%016llx%08x.pose", key.fbxHash, key.skeletonHash, (unsigned int)(fps ^ (fps >> 32)));
+
+    std::string filePath = directoryPath;
+    if (!filePath.empty() && filePath.back() != '\\' && filePath.back() != '/')
+        filePath += '\\';
+
+    return filePath + fileName;
+}
+
+bool loadPoseCache(const char* filePath, const PoseCacheKey& key, SampledAnimation& sampledAnimation)
+{
+    MappedFile file;
+    if (!file.open(filePath) || file.dataSize < sizeof(PoseCacheHeader))
+        return false;
+
+    const unsigned char* data = (const unsigned char*)file.data;
+    const PoseCacheHeader* header = (const PoseCacheHeader*)data;
+
+    if (memcmp(header->magic, POSE_CACHE_MAGIC, sizeof(POSE_CACHE_MAGIC)) != 0 || header->version != POSE_CACHE_VERSION ||
+        header->fbxHash != key.fbxHash || header->skeletonHash != key.skeletonHash || header->fps != key.fps ||
+        header->trackCount <= 0 || header->frameCount <= 0)
+    {
+        return false;
+    }
+
+    const PoseCacheLayout layout(header->trackCount, header->frameCount, header->annotationCount, header->textSize);
+    if (file.dataSize != layout.fileSize)
+        return false;
+
+    const size_t count = (size_t)header->trackCount * header->frameCount;
+
+    sampledAnimation.duration = header->duration;
+
+    sampledAnimation.transformTrackToBoneIndices.setSize(header->trackCount);
+    memcpy(&sampledAnimation.transformTrackToBoneIndices[0], data + layout.indicesOffset, header->trackCount * sizeof(hkInt16));
+
+    PoseBuffer& poses = sampledAnimation.poses;
+    poses.resize(header->trackCount, header->frameCount);
+
+    const float* rotations = (const float*)(data + layout.rotationsOffset);
+
+    memcpy(poses.rotationX.data(), rotations, count * sizeof(float));
+    memcpy(poses.rotationY.data(), rotations + count, count * sizeof(float));
+    memcpy(poses.rotationZ.data(), rotations + 2 * count, count * sizeof(float));
+    memcpy(poses.rotationW.data(), rotations + 3 * count, count * sizeof(float));
+
+    memcpy(&poses.translations[0], data + layout.translationsOffset, count * sizeof(hkVector4));
+    memcpy(&poses.scales[0], data + layout.scalesOffset, count * sizeof(hkVector4));
+
+    const PoseCacheAnnotation* annotations = (const PoseCacheAnnotation*)(data + layout.annotationsOffset);
+    const char* text = (const char*)(data + layout.textOffset);
+
+    sampledAnimation.annotations.clear();
+
+    for (unsigned int i = 0; i < header->annotationCount; i++)
+    {
+        if ((uint64_t)annotations[i].textOffset + annotations[i].textSize > header->textSize)
+            return false;
+
+        SampledAnnotation annotation;
+        annotation.boneIndex = annotations[i].boneIndex;
+        annotation.time = annotations[i].time;
+        annotation.text.assign(text + annotations[i].textOffset, annotations[i].textSize);
+
+        sampledAnimation.annotations.push_back(annotation);
+    }
+
+    return true;
+}
+
+bool savePoseCache(const char* filePath, const PoseCacheKey& key, const SampledAnimation& sampledAnimation)
+{
+    const PoseBuffer& poses = sampledAnimation.poses;
+
+    if (poses.trackCount <= 0 || poses.frameCount <= 0)
+        return false;
+
+    PoseCacheHeader header;
+    memcpy(header.magic, POSE_CACHE_MAGIC, sizeof(POSE_CACHE_MAGIC));
+    header.version = POSE_CACHE_VERSION;
+    header.fbxHash = key.fbxHash;
+    header.skeletonHash = key.skeletonHash;
+    header.fps = key.fps;
+    header.duration = sampledAnimation.duration;
+    header.trackCount = poses.trackCount;
+    header.frameCount = poses.frameCount;
+    header.annotationCount = (unsigned int)sampledAnimation.annotations.size();
+    header.textSize = 0;
+
+    std::vector<PoseCacheAnnotation> annotations;
+
+    for (auto& annotation : sampledAnimation.annotations)
+    {
+        PoseCacheAnnotation cacheAnnotation = { annotation.boneIndex, annotation.time, header.textSize, (unsigned int)annotation.text.size() };
+        annotations.push_back(cacheAnnotation);
+
+        header.textSize += cacheAnnotation.textSize;
+    }
+
+    const PoseCacheLayout layout(header.trackCount, header.frameCount, header.annotationCount, header.textSize);
+    const size_t count = (size_t)poses.trackCount * poses.frameCount;
+
+    // Build the whole file in memory, so it gets written with a single write and replaced atomically,
+    // and a killed run or a concurrent writer never leaves a truncated cache entry behind.
+    std::vector<char> data(layout.fileSize);
+
+    memcpy(&data[0], &header, sizeof(header));
+    memcpy(&data[layout.indicesOffset], &sampledAnimation.transformTrackToBoneIndices[0], poses.trackCount * sizeof(hkInt16));
+
+    float* rotations = (float*)&data[layout.rotationsOffset];
+
+    memcpy(rotations, poses.rotationX.data(), count * sizeof(float));
+    memcpy(rotations + count, poses.rotationY.data(), count * sizeof(float));
+    memcpy(rotations + 2 * count, poses.rotationZ.data(), count * sizeof(float));
+    memcpy(rotations + 3 * count, poses.rotationW.data(), count * sizeof(float));
+
+    memcpy(&data[layout.translationsOffset], &poses.translations[0], count * sizeof(hkVector4));
+    memcpy(&data[layout.scalesOffset], &poses.scales[0], count * sizeof(hkVector4));
+
+    if (!annotations.empty())
+        memcpy(&data[layout.annotationsOffset], annotations.data(), annotations.size() * sizeof(PoseCacheAnnotation));
+
+    for (size_t i = 0; i < annotations.size(); i++)
+    {
+        if (annotations[i].textSize != 0)
+            memcpy(&data[layout.textOffset + annotations[i].textOffset], sampledAnimation.annotations[i].text.data(), annotations[i].textSize);
+    }
+
+    return writeFileAtomic(filePath, data.data(), data.size(), false);
+}
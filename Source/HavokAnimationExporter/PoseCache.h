@@ -0,0 +1,16 @@
+#pragma once
+
+struct SampledAnimation;
+
+// Identifies sampled poses by everything sampling depends on.
+struct PoseCacheKey
+{
+    uint64_t fbxHash;
+    uint64_t skeletonHash;
+    double fps;
+};
+
+std::string getPoseCacheFilePath(const std::string& directoryPath, const PoseCacheKey& key);
+
+bool loadPoseCache(const char* filePath, const PoseCacheKey& key, SampledAnimation& sampledAnimation);
+bool savePoseCache(const char* filePath, const PoseCacheKey& key, const SampledAnimation& sampledAnimation);